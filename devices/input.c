@@ -6,10 +6,14 @@
 /* Stores keys from the keyboard and serial port. */
 static struct intq buffer;
 
+/* Threads waiting for the buffer to become nonempty. */
+static struct waitq readers;
+
 /* Initializes the input buffer. */
 void
 input_init (void) {
 	intq_init (&buffer);
+	waitq_init (&readers);
 }
 
 /* Adds a key to the input buffer.
@@ -21,6 +25,7 @@ input_putc (uint8_t key) {
 
 	intq_putc (&buffer, key);
 	serial_notify ();
+	waitq_wake_all (&readers);
 }
 
 /* Retrieves a key from the input buffer.
@@ -46,3 +51,19 @@ input_full (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	return intq_full (&buffer);
 }
+
+/* Returns true if the input buffer is empty,
+   false otherwise.
+   Interrupts must be off. */
+bool
+input_empty (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return intq_empty (&buffer);
+}
+
+/* Returns the wait queue that is woken whenever a key is added
+   to the input buffer. */
+struct waitq *
+input_waitq (void) {
+	return &readers;
+}
@@ -75,9 +75,12 @@ void timer_calibrate(void)
 int64_t
 timer_ticks(void)
 {
-	enum intr_level old_level = intr_disable();
-	int64_t t = ticks;
-	intr_set_level(old_level);
+	/* TICKS is only written by the timer interrupt, and an aligned
+	   64-bit load is a single instruction on x86-64, so we can read
+	   it without turning interrupts off.  The barriers keep the
+	   compiler from caching or reordering the load. */
+	barrier();
+	int64_t t = *(volatile int64_t *)&ticks;
 	barrier();
 	return t;
 }
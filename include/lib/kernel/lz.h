@@ -0,0 +1,19 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fast LZ77 compression in the style of LZ4.  See lz.c. */
+
+/* Entries in the match table that lz_compress() works in. */
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+size_t lz_compress (const void *src, size_t src_size,
+		void *dst, size_t dst_size, uint16_t work[LZ_HASH_SIZE]);
+bool lz_decompress (const void *src, size_t src_size,
+		void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -36,6 +36,12 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra: I/O multiplexing. */
+	SYS_POLL,                   /* Wait for any of several fds. */
+
+	/* Extra: diagnostics. */
+	SYS_MEMPROF,                /* Print the kernel allocation profile. */
 };
 
 #endif /* lib/syscall-nr.h */
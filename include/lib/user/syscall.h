@@ -17,6 +17,19 @@ typedef int off_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* A file descriptor to wait on, for poll(). */
+struct pollfd {
+	int fd;        /* File descriptor. */
+	short events;  /* Events to wait for. */
+	short revents; /* Events that occurred, set by poll(). */
+};
+
+/* Bits for events and revents. */
+#define POLLIN 0x001   /* Reading will not block. */
+#define POLLOUT 0x004  /* Writing will not block. */
+#define POLLERR 0x008  /* Error condition (revents only). */
+#define POLLNVAL 0x020 /* FD is not open (revents only). */
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0 /* Successful execution. */
 #define EXIT_FAILURE 1 /* Unsuccessful execution. */
@@ -37,6 +50,8 @@ void seek(int fd, unsigned position);
 unsigned tell(int fd);
 void close(int fd);
 int dup2(int oldfd, int newfd);
+int poll(struct pollfd *fds, unsigned nfds, int timeout);
+int memprof(void);
 
 /* File Discriptor */
 struct lock filesys_lock;
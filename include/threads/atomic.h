@@ -0,0 +1,194 @@
+#ifndef THREADS_ATOMIC_H
+#define THREADS_ATOMIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Atomic operations.
+ *
+ * Typed wrappers around the x86-64 locked read-modify-write
+ * instructions.  A `lock'-prefixed instruction is a full memory
+ * barrier on x86-64, so every read-modify-write below has both
+ * acquire and release semantics.  Plain loads already have
+ * acquire semantics and plain stores release semantics under
+ * the x86-64 memory model ([IA32-v3a] 8.2.2 "Memory Ordering in
+ * P6 and More Recent Processor Families"), so
+ * atomic_load_acquire() and atomic_store_release() only need to
+ * stop the compiler from reordering around them.
+ *
+ * The wrapping structs exist so that an atomic variable cannot
+ * be accidentally read or written with an ordinary access. */
+
+/* A 32-bit atomic integer. */
+struct atomic32 {
+	volatile uint32_t value;
+};
+
+/* A 64-bit atomic integer. */
+struct atomic64 {
+	volatile uint64_t value;
+};
+
+#define ATOMIC_INIT(V) { .value = (V) }
+
+/* Hint to the processor that we are in a spin-wait loop.
+   See [IA32-v2b] "PAUSE". */
+static inline void
+cpu_relax (void) {
+	asm volatile ("pause" : : : "memory");
+}
+
+/* 32-bit operations. */
+
+static inline uint32_t
+atomic32_load_acquire (const struct atomic32 *a) {
+	uint32_t v = a->value;
+	asm volatile ("" : : : "memory");
+	return v;
+}
+
+static inline void
+atomic32_store_release (struct atomic32 *a, uint32_t v) {
+	asm volatile ("" : : : "memory");
+	a->value = v;
+}
+
+/* Stores NEW in A if A holds OLD.  Returns the value A held
+   before, which equals OLD on success. */
+static inline uint32_t
+atomic32_cmpxchg (struct atomic32 *a, uint32_t old, uint32_t new) {
+	uint32_t prev;
+	asm volatile ("lock cmpxchgl %2, %1"
+			: "=a" (prev), "+m" (a->value)
+			: "r" (new), "0" (old)
+			: "memory", "cc");
+	return prev;
+}
+
+/* Adds V to A and returns A's previous value. */
+static inline uint32_t
+atomic32_xadd (struct atomic32 *a, uint32_t v) {
+	asm volatile ("lock xaddl %0, %1"
+			: "+r" (v), "+m" (a->value)
+			:
+			: "memory", "cc");
+	return v;
+}
+
+/* Stores V in A and returns A's previous value. */
+static inline uint32_t
+atomic32_xchg (struct atomic32 *a, uint32_t v) {
+	/* XCHG with a memory operand is always locked. */
+	asm volatile ("xchgl %0, %1"
+			: "+r" (v), "+m" (a->value)
+			:
+			: "memory");
+	return v;
+}
+
+/* ORs MASK into A and returns A's previous value. */
+static inline uint32_t
+atomic32_fetch_or (struct atomic32 *a, uint32_t mask) {
+	uint32_t old = a->value;
+	uint32_t prev;
+	while ((prev = atomic32_cmpxchg (a, old, old | mask)) != old)
+		old = prev;
+	return old;
+}
+
+/* ANDs MASK into A and returns A's previous value. */
+static inline uint32_t
+atomic32_fetch_and (struct atomic32 *a, uint32_t mask) {
+	uint32_t old = a->value;
+	uint32_t prev;
+	while ((prev = atomic32_cmpxchg (a, old, old & mask)) != old)
+		old = prev;
+	return old;
+}
+
+/* 64-bit operations. */
+
+static inline uint64_t
+atomic64_load_acquire (const struct atomic64 *a) {
+	uint64_t v = a->value;
+	asm volatile ("" : : : "memory");
+	return v;
+}
+
+static inline void
+atomic64_store_release (struct atomic64 *a, uint64_t v) {
+	asm volatile ("" : : : "memory");
+	a->value = v;
+}
+
+static inline uint64_t
+atomic64_cmpxchg (struct atomic64 *a, uint64_t old, uint64_t new) {
+	uint64_t prev;
+	asm volatile ("lock cmpxchgq %2, %1"
+			: "=a" (prev), "+m" (a->value)
+			: "r" (new), "0" (old)
+			: "memory", "cc");
+	return prev;
+}
+
+static inline uint64_t
+atomic64_xadd (struct atomic64 *a, uint64_t v) {
+	asm volatile ("lock xaddq %0, %1"
+			: "+r" (v), "+m" (a->value)
+			:
+			: "memory", "cc");
+	return v;
+}
+
+static inline uint64_t
+atomic64_xchg (struct atomic64 *a, uint64_t v) {
+	asm volatile ("xchgq %0, %1"
+			: "+r" (v), "+m" (a->value)
+			:
+			: "memory");
+	return v;
+}
+
+static inline uint64_t
+atomic64_fetch_or (struct atomic64 *a, uint64_t mask) {
+	uint64_t old = a->value;
+	uint64_t prev;
+	while ((prev = atomic64_cmpxchg (a, old, old | mask)) != old)
+		old = prev;
+	return old;
+}
+
+static inline uint64_t
+atomic64_fetch_and (struct atomic64 *a, uint64_t mask) {
+	uint64_t old = a->value;
+	uint64_t prev;
+	while ((prev = atomic64_cmpxchg (a, old, old & mask)) != old)
+		old = prev;
+	return old;
+}
+
+/* Pointer operations. */
+
+/* Stores NEW in *P if *P is OLD.  Returns the previous value of
+   *P, which equals OLD on success. */
+static inline void *
+atomic_ptr_cmpxchg (void *volatile *p, void *old, void *new) {
+	void *prev;
+	asm volatile ("lock cmpxchgq %2, %1"
+			: "=a" (prev), "+m" (*p)
+			: "r" (new), "0" (old)
+			: "memory", "cc");
+	return prev;
+}
+
+/* Stores V in *P and returns the previous value of *P. */
+static inline void *
+atomic_ptr_xchg (void *volatile *p, void *v) {
+	asm volatile ("xchgq %0, %1"
+			: "+r" (v), "+m" (*p)
+			:
+			: "memory");
+	return v;
+}
+
+#endif /* threads/atomic.h */
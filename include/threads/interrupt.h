@@ -75,4 +75,8 @@ void intr_yield_on_return (void);
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
+/* -irqsoff: Trace interrupts-off latency? */
+extern bool intr_irqsoff_trace;
+void intr_print_stats (void);
+
 #endif /* threads/interrupt.h */
@@ -0,0 +1,29 @@
+#ifndef THREADS_MEMPROF_H
+#define THREADS_MEMPROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Kernel allocation profiler.
+
+   When enabled with the kernel command-line option "-memprof",
+   every malloc() and palloc_get_*() call is tagged with its
+   caller's return address, and the memory live at each call site
+   is tracked.  See memprof.c for details. */
+
+/* Allocators whose calls are profiled. */
+enum memprof_kind {
+	MEMPROF_MALLOC,             /* malloc(), calloc(), realloc(). */
+	MEMPROF_PALLOC              /* palloc_get_page(), _multiple(). */
+};
+
+extern bool memprof_enabled;
+
+void memprof_init (void);
+void memprof_alloc (enum memprof_kind, const void *ptr, size_t size,
+		const void *site);
+void memprof_resize (const void *ptr, size_t size);
+void memprof_free (const void *ptr);
+int memprof_dump (void);
+
+#endif /* threads/memprof.h */
@@ -41,5 +41,12 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=maps a large page (PDEs and PDPEs only). */
+
+/* Bytes mapped by a PDE or a PDPE with PTE_PS set.  Such an entry
+   maps the large page directly instead of pointing to a lower
+   level table; its other flags mean the same as in a PTE. */
+#define LARGE_PGSIZE (1UL << PDXSHIFT)   /* 2 MB. */
+#define HUGE_PGSIZE (1UL << PDPESHIFT)   /* 1 GB. */
 
 #endif /* threads/pte.h */
@@ -0,0 +1,50 @@
+#ifndef THREADS_SHRINKER_H
+#define THREADS_SHRINKER_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Memory-pressure callbacks.
+
+   A subsystem that holds memory it could give back, such as a
+   cache, registers a shrinker.  When the page allocator runs out
+   of kernel pages, it calls the registered shrinkers, lowest
+   priority value first, until enough pages have been freed, and
+   then retries.  See shrinker.c for details. */
+
+/* Returns about how many pages the shrinker could free now. */
+typedef size_t shrinker_count_func (void *aux);
+
+/* Frees up to PAGE_CNT pages and returns how many it freed.
+   Must not sleep waiting for a lock, since the thread that ran
+   out of memory may hold it: use lock_try_acquire(). */
+typedef size_t shrinker_scan_func (size_t page_cnt, void *aux);
+
+/* Priorities.  Cheap, idle memory goes first. */
+#define SHRINK_PRI_ALLOC 10     /* Allocator free lists. */
+#define SHRINK_PRI_CACHE 20     /* Caches of reusable objects. */
+#define SHRINK_PRI_DATA 30      /* Data that must be reread or written. */
+
+/* A shrinker. */
+struct shrinker {
+	const char *name;           /* Name, for statistics. */
+	int priority;               /* Lower values run first. */
+	shrinker_count_func *count; /* Counts reclaimable pages. */
+	shrinker_scan_func *scan;   /* Reclaims pages. */
+	void *aux;                  /* Passed to COUNT and SCAN. */
+
+	/* Statistics. */
+	uint64_t calls;             /* Calls to SCAN. */
+	uint64_t reclaimed;         /* Pages SCAN freed, in total. */
+
+	struct list_elem elem;      /* Element in list of shrinkers. */
+};
+
+void shrinker_init (void);
+void shrinker_register (struct shrinker *);
+void shrinker_unregister (struct shrinker *);
+size_t shrink_memory (size_t page_cnt);
+void shrinker_print_stats (void);
+
+#endif /* threads/shrinker.h */
@@ -0,0 +1,52 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Object caches.
+
+   A slab cache hands out objects of one fixed size, packed
+   exactly (up to alignment) into single-page "slabs", instead of
+   rounding every request up to a power of two as malloc() does.
+   See slab.c for details. */
+
+/* Optional constructor, run on each object once when its slab is
+   created.  Objects must be freed in their constructed state. */
+typedef void slab_ctor_func (void *obj);
+
+/* An object cache. */
+struct slab_cache {
+	const char *name;           /* Name, for statistics. */
+	size_t obj_size;            /* Size of each object in bytes. */
+	size_t stride;              /* Distance between objects. */
+	size_t obj_ofs;             /* Offset of first object in slab. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	slab_ctor_func *ctor;       /* Constructor, or null. */
+
+	struct lock lock;           /* Protects everything below. */
+	struct list partial;        /* Slabs with used and free objects. */
+	struct list full;           /* Slabs with no free objects. */
+	struct list empty;          /* Slabs with no used objects. */
+
+	/* Statistics. */
+	size_t slab_cnt;            /* Slabs, on all three lists. */
+	size_t empty_cnt;           /* Slabs on the empty list. */
+	size_t in_use;              /* Objects handed out. */
+	uint64_t allocs;            /* Calls to slab_alloc(). */
+	uint64_t frees;             /* Calls to slab_free(). */
+
+	struct list_elem elem;      /* Element in list of all caches. */
+};
+
+void slab_init (void);
+void slab_cache_init (struct slab_cache *, const char *name,
+		size_t size, size_t align, slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+size_t slab_cache_shrink (struct slab_cache *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
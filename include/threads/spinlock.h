@@ -0,0 +1,74 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/atomic.h"
+#include "threads/interrupt.h"
+
+/* Busy-waiting locks.
+ *
+ * Unlike the sleeping locks in synch.h, a spinlock never blocks,
+ * so it may protect data that is touched with interrupts off or
+ * by code that must not sleep.  Holding a spinlock disables
+ * preemption; the _irqsave variants additionally disable
+ * interrupts and must be used for data that an interrupt handler
+ * also takes the lock for.  Critical sections must be short.
+ *
+ * Two flavours are provided.  Both are FIFO-fair:
+ *
+ *   - A ticket lock hands out increasing tickets and serves them
+ *     in order.  It is two words and needs no per-waiter state.
+ *
+ *   - An MCS lock queues waiters on nodes they supply themselves
+ *     (usually on the stack), so each waiter spins on its own
+ *     cache line.  Preferable when many CPUs contend. */
+
+/* Contention counters, kept per lock. */
+struct spin_stats {
+	uint64_t acquired;          /* Successful acquisitions. */
+	uint64_t contended;         /* Acquisitions that had to wait. */
+	uint64_t spins;             /* Busy-wait iterations, in total. */
+};
+
+void spin_stats_print (const char *name, const struct spin_stats *);
+
+/* Ticket lock. */
+struct ticket_lock {
+	struct atomic32 next;       /* Next ticket to hand out. */
+	struct atomic32 owner;      /* Ticket now being served. */
+	struct spin_stats stats;    /* Contention counters. */
+};
+
+#define TICKET_LOCK_INITIALIZER { ATOMIC_INIT (0), ATOMIC_INIT (0), { 0, 0, 0 } }
+
+void ticket_lock_init (struct ticket_lock *);
+void ticket_lock_acquire (struct ticket_lock *);
+bool ticket_lock_try_acquire (struct ticket_lock *);
+void ticket_lock_release (struct ticket_lock *);
+enum intr_level ticket_lock_acquire_irqsave (struct ticket_lock *);
+void ticket_lock_release_irqrestore (struct ticket_lock *, enum intr_level);
+bool ticket_lock_held (const struct ticket_lock *);
+
+/* MCS queue lock. */
+struct mcs_node {
+	struct mcs_node *volatile next; /* Next waiter in line. */
+	volatile bool locked;           /* True while we must keep waiting. */
+};
+
+struct mcs_lock {
+	struct mcs_node *volatile tail; /* Last waiter, or null if free. */
+	struct spin_stats stats;        /* Contention counters. */
+};
+
+#define MCS_LOCK_INITIALIZER { NULL, { 0, 0, 0 } }
+
+void mcs_lock_init (struct mcs_lock *);
+void mcs_lock_acquire (struct mcs_lock *, struct mcs_node *);
+bool mcs_lock_try_acquire (struct mcs_lock *, struct mcs_node *);
+void mcs_lock_release (struct mcs_lock *, struct mcs_node *);
+enum intr_level mcs_lock_acquire_irqsave (struct mcs_lock *, struct mcs_node *);
+void mcs_lock_release_irqrestore (struct mcs_lock *, struct mcs_node *,
+		enum intr_level);
+
+#endif /* threads/spinlock.h */
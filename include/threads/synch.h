@@ -4,10 +4,17 @@
 #include <list.h>
 #include <stdbool.h>
 #include <debug.h>
+#include "threads/atomic.h"
 
-/* A counting semaphore. */
+/* A counting semaphore.
+
+   COUNT packs the semaphore's value into its low 32 bits and the
+   number of threads asleep on WAITERS into its high 32 bits, so
+   that a single locked instruction can both update the value and
+   learn whether anybody needs waking.  WAITERS and the sleeper
+   count only change with interrupts off. */
 struct semaphore {
-	unsigned value;             /* Current value. */
+	struct atomic64 count;      /* Value and sleeper count. */
 	struct list waiters;        /* List of waiting threads. */
 };
 
@@ -39,6 +46,29 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Wait queue.
+
+   A list of threads waiting, in thread_sleep_event(), for
+   something to happen to an object.  Unlike a condition
+   variable, a thread may sit on several wait queues at once and
+   a wait queue may be woken from an interrupt handler, so it
+   suits waiting on any of several devices.  All functions
+   require interrupts to be off. */
+struct waitq {
+	struct list entries;        /* List of struct waitq_entry. */
+};
+
+/* One thread's membership in a wait queue. */
+struct waitq_entry {
+	struct list_elem elem;      /* List element. */
+	struct thread *thread;      /* Waiting thread. */
+};
+
+void waitq_init (struct waitq *);
+void waitq_add (struct waitq *, struct waitq_entry *);
+void waitq_remove (struct waitq_entry *);
+void waitq_wake_all (struct waitq *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
@@ -106,6 +106,10 @@ struct thread
 	/* Store local tick */
 	int64_t wakeup_tick;
 
+	/* Event wait */
+	bool event_wait;  /* Blocked in thread_sleep_event(). */
+	bool event_timed; /* ...and also on the sleep list. */
+
 	/* Priority Donation */
 	int origin_priority;
 	struct lock *wait_on_lock;
@@ -116,6 +120,10 @@ struct thread
 	int nice;
 	int recent_cpu;
 
+	/* Preemption control */
+	int preempt_count;	  /* Nesting depth of preempt_disable(). */
+	bool preempt_pending; /* Preemption deferred by preempt_count. */
+
 	/* User program */
 	/*
 	TODO
@@ -152,6 +160,7 @@ struct thread
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp; /* User stack pointer at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -195,11 +204,17 @@ void do_iret(struct intr_frame *tf);
 /* Alarm Clock */
 void thread_sleep(int64_t ticks);
 void thread_wakeup(int64_t global_tick);
+void thread_sleep_event(int64_t ticks);
+void thread_wake_event(struct thread *t);
 
 /* Priority Scheduling */
 bool cmp_priority(struct list_elem *a, struct list_elem *b, void *aux UNUSED);
 void test_max_priority(void);
 
+/* Preemption control */
+void preempt_disable(void);
+void preempt_enable(void);
+
 /* Priority Donation */
 void donate_priority(void);
 
@@ -3,11 +3,15 @@
 #include "vm/vm.h"
 struct page;
 enum vm_type;
+struct swap_entry;
 
 struct anon_page {
+	struct swap_entry *swap;  /* Where it is swapped out, or null. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_share (struct page *child, const struct page *parent);
+void anon_print_stats (void);
 
 #endif
@@ -6,12 +6,33 @@
 struct page;
 enum vm_type;
 
+/* Where a page's initial contents come from: READ_BYTES bytes of
+ * FILE at offset OFS, followed by zeros to the end of the page.
+ * FILE is a private handle, closed with the segment. */
+struct file_segment {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+};
+
 struct file_page {
+	struct file_segment seg;   /* Backing part of the file. */
+	bool text;                 /* Executable text; see VM_TEXT. */
 };
 
+struct supplemental_page_table;
+
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+void mmap_kill (struct supplemental_page_table *);
+bool file_backed_copy (struct page *);
+bool file_lazy_load (struct page *page, void *aux);
+void file_backed_adopt (struct page *page);
+struct file_segment *file_segment_dup (const struct file_segment *);
+void file_segment_free (struct file_segment *);
 #endif
@@ -1,6 +1,8 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -20,6 +22,12 @@ enum vm_type {
 	VM_MARKER_0 = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
 
+	/* Marks stack pages. */
+	VM_STACK = VM_MARKER_0,
+	/* Marks read-only executable pages, shared through the text
+	 * cache; see vm.c. */
+	VM_TEXT = VM_MARKER_1,
+
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
 };
@@ -33,6 +41,8 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct text_entry;
+struct merge_entry;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -46,6 +56,12 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* True if the user may write the page. */
+	bool dirty;            /* Written since last saved; see vm.c. */
+	bool referenced;       /* Accessed since the clock hand passed. */
+	unsigned ws_seen;      /* Last working-set sample it was seen in. */
+	struct thread *owner;  /* Process whose address space holds it. */
+	struct list_elem frame_elem; /* Element in its frame's page list. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +75,21 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".  There is one for each physical
+ * page of RAM; see vm.c.  A frame in use holds one page, or
+ * several that share it copy-on-write. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct list pages;     /* Pages that map the frame. */
+	size_t page_cnt;       /* Number of pages in PAGES. */
+	struct text_entry *text; /* Text cache entry, or null. */
+	struct list_elem elem; /* Element in the clock list while in use. */
+	bool pinned;           /* True while it must not be evicted. */
+
+	/* Same-page merging; see vm.c. */
+	uint64_t checksum;     /* Contents when last scanned. */
+	struct merge_entry *merge; /* Entry in the merge table, or null. */
+	bool merged;           /* Holds pages merged from other frames. */
 };
 
 /* The function table for page operations.
@@ -81,10 +108,47 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* A sequential reader of one file, for fault-around. */
+struct fa_stream {
+	struct inode *inode;   /* File read, or null if the slot is unused. */
+	void *next;            /* Where it faults next if it keeps going. */
+	size_t window;         /* Pages to map per fault, counting it. */
+	unsigned run;          /* Sequential faults so far. */
+};
+
+/* Streams a process tracks at once. */
+#define FA_STREAMS 4
+
+/* Fault-around state and counters of a process; see vm.c. */
+struct fault_around {
+	struct fa_stream streams[FA_STREAMS];
+	unsigned victim;       /* Stream to replace next. */
+	uint64_t faults;       /* Faults on file-backed pages. */
+	uint64_t mapped;       /* Pages mapped around those faults. */
+};
+
+/* Memory use of a process; see vm.c.  Protected by the frame
+ * table lock, except SWAP, which belongs to anon.c. */
+struct vm_usage {
+	size_t rss;            /* Pages in frames other than the zero frame. */
+	size_t rss_peak;       /* Largest RSS so far. */
+	size_t rss_limit;      /* Most RSS allowed, or 0 for no limit. */
+	size_t file;           /* Pages in RSS that are backed by files. */
+	size_t swap;           /* Anonymous pages swapped out. */
+	size_t ws;             /* Working set estimate, in pages. */
+	size_t ws_cur;         /* Pages seen accessed in sample WS_EPOCH. */
+	unsigned ws_epoch;     /* Sample that WS_CUR counts. */
+};
+
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * A radix tree indexed like the hardware page table; see vm.c. */
+struct spt_node;
 struct supplemental_page_table {
+	struct spt_node *root; /* Top-level node, or null if empty. */
+	size_t page_cnt;       /* Number of pages in the table. */
+	struct list mmaps;     /* Memory mappings; see file.c. */
+	struct fault_around fa;
+	struct vm_usage usage;
 };
 
 #include "threads/thread.h"
@@ -97,6 +161,15 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Same-page merging tunables, from the kernel command line. */
+extern size_t merge_scan_pages;
+extern unsigned merge_scan_ms;
+
+/* Resident set tunables, from the kernel command line. */
+extern size_t rss_limit;
+extern unsigned ws_sample_ms;
+extern bool rss_report;
+
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
@@ -106,6 +179,8 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_release_frame (struct page *page, bool writeback);
+void vm_print_stats (void);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
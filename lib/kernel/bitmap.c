@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,10 +24,27 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Two summary arrays, with one bit per element of BITS, let
+   searches skip whole elements at a time: bit I of HAS_ONE is
+   set if element I has any bit set, and bit I of HAS_ZERO if it
+   has any (in-range) bit clear.  Searching for a run of bits
+   jumps over elements that cannot start or continue one using
+   the summaries, and walks within an element with count-trailing-
+   zeros rather than bit by bit.  Finding a run of N bits thus
+   costs about one step per element instead of N steps per bit.
+
+   Single-bit updates of BITS are atomic, as before, but the
+   summaries are updated after them without synchronization, so
+   callers that modify a bitmap concurrently with a search must
+   serialize, as they already had to for bitmap_scan_and_flip(). */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *has_one; /* Summary: elements with a set bit. */
+	elem_type *has_zero; /* Summary: elements with a clear bit. */
+	size_t cursor;      /* Where the next next-fit scan starts. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -62,6 +80,93 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of bytes for the summaries of BIT_CNT bits. */
+static inline size_t
+summary_byte_cnt (size_t bit_cnt) {
+	return byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Returns the mask of bits in use in element IDX of B. */
+static inline elem_type
+elem_mask (const struct bitmap *b, size_t idx) {
+	return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns the index of the lowest set bit in X, which must be
+   nonzero. */
+static inline int
+lowest_bit (elem_type x) {
+	return __builtin_ctzl (x);
+}
+
+/* Returns the number of set bits in X.  Written out, rather than
+   using __builtin_popcountl(), because without SSE4 that becomes
+   a call into libgcc, which the kernel does not link. */
+static inline int
+pop_count (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
+/* Brings the summary bits for element IDX of B up to date. */
+static inline void
+update_summary (struct bitmap *b, size_t idx) {
+	elem_type e = b->bits[idx];
+	elem_type mask = bit_mask (idx);
+
+	if (e != 0)
+		b->has_one[elem_idx (idx)] |= mask;
+	else
+		b->has_one[elem_idx (idx)] &= ~mask;
+
+	if (e != elem_mask (b, idx))
+		b->has_zero[elem_idx (idx)] |= mask;
+	else
+		b->has_zero[elem_idx (idx)] &= ~mask;
+}
+
+/* Sets the bits in MASK of element IDX of B to VALUE. */
+static inline void
+set_bits (struct bitmap *b, size_t idx, elem_type mask, bool value) {
+	if (value)
+		b->bits[idx] |= mask;
+	else
+		b->bits[idx] &= ~mask;
+	update_summary (b, idx);
+}
+
+/* Returns the in-range bits of element IDX of B, inverted if
+   VALUE is false, so that the bits equal to VALUE read as 1. */
+static inline elem_type
+value_bits (const struct bitmap *b, size_t idx, bool value) {
+	elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+	return e & elem_mask (b, idx);
+}
+
+/* Returns the index of the first element of B at or after IDX
+   whose summary bit in SUMMARY is set, or elem_cnt(bit count) if
+   there is none. */
+static size_t
+next_summary (const struct bitmap *b, const elem_type *summary, size_t idx) {
+	size_t elems = elem_cnt (b->bit_cnt);
+	size_t s = elem_idx (idx);
+	elem_type word;
+
+	if (idx >= elems)
+		return elems;
+
+	word = summary[s] & ~(bit_mask (idx) - 1);
+	while (word == 0) {
+		if (++s >= elem_cnt (elems))
+			return elems;
+		word = summary[s];
+	}
+	idx = s * ELEM_BITS + lowest_bit (word);
+	return idx < elems ? idx : elems;
+}
 
 /* Creation and destruction. */
 
@@ -74,8 +179,12 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
-		b->bits = malloc (byte_cnt (bit_cnt));
+		b->bits = malloc (byte_cnt (bit_cnt) + 2 * summary_byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
+			b->has_one = b->bits + elem_cnt (bit_cnt);
+			b->has_zero = b->has_one + elem_cnt (elem_cnt (bit_cnt));
+			b->cursor = 0;
+			memset (b->has_one, 0, 2 * summary_byte_cnt (bit_cnt));
 			bitmap_set_all (b, false);
 			return b;
 		}
@@ -95,6 +204,10 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->has_one = b->bits + elem_cnt (bit_cnt);
+	b->has_zero = b->has_one + elem_cnt (elem_cnt (bit_cnt));
+	b->cursor = 0;
+	memset (b->has_one, 0, 2 * summary_byte_cnt (bit_cnt));
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -103,7 +216,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
    with BIT_CNT bits (for use with bitmap_create_in_buf()). */
 size_t
 bitmap_buf_size (size_t bit_cnt) {
-	return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+	return sizeof (struct bitmap) + byte_cnt (bit_cnt)
+		+ 2 * summary_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -148,6 +262,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
 	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -160,6 +275,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +290,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -197,47 +314,91 @@ bitmap_set_all (struct bitmap *b, bool value) {
 /* Sets the CNT bits starting at START in B to VALUE. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t lo = start % ELEM_BITS;
+		size_t n = end - start < ELEM_BITS - lo ? end - start : ELEM_BITS - lo;
+		elem_type mask = n == ELEM_BITS ? (elem_type) -1
+			: (((elem_type) 1 << n) - 1) << lo;
+
+		set_bits (b, idx, mask, value);
+		start += n;
+	}
+}
+
+/* Calls FUNC once for each element of B that holds any of the
+   bits between START and START + CNT, exclusive, passing the
+   element and a mask of the bits in that range.  Stops early and
+   returns true if FUNC returns true; otherwise returns false. */
+static bool
+for_each_elem (const struct bitmap *b, size_t start, size_t cnt,
+		bool (*func) (elem_type bits, elem_type mask, void *aux), void *aux) {
+	size_t end = start + cnt;
+
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t lo = start % ELEM_BITS;
+		size_t n = end - start < ELEM_BITS - lo ? end - start : ELEM_BITS - lo;
+		elem_type mask = n == ELEM_BITS ? (elem_type) -1
+			: (((elem_type) 1 << n) - 1) << lo;
+
+		if (func (b->bits[idx], mask, aux))
+			return true;
+		start += n;
+	}
+	return false;
+}
+
+/* for_each_elem() helper for bitmap_count(). */
+static bool
+count_elem (elem_type bits, elem_type mask, void *cnt_) {
+	size_t *cnt = cnt_;
+	*cnt += pop_count (bits & mask);
+	return false;
+}
+
+/* for_each_elem() helper for bitmap_contains() with VALUE true. */
+static bool
+contains_one (elem_type bits, elem_type mask, void *aux UNUSED) {
+	return (bits & mask) != 0;
+}
+
+/* for_each_elem() helper for bitmap_contains() with VALUE false. */
+static bool
+contains_zero (elem_type bits, elem_type mask, void *aux UNUSED) {
+	return (~bits & mask) != 0;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t one_cnt = 0;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	for_each_elem (b, start, cnt, count_elem, &one_cnt);
+	return value ? one_cnt : cnt - one_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return for_each_elem (b, start, cnt, value ? contains_one : contains_zero,
+			NULL);
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -269,15 +430,71 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
    If there is no such group, returns BITMAP_ERROR. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	const elem_type *has_value = value ? b->has_one : b->has_zero;
+	const elem_type *has_other = value ? b->has_zero : b->has_one;
+	size_t elems, idx, run_start = 0, run_len = 0;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	elems = elem_cnt (b->bit_cnt);
+	idx = elem_idx (start);
+	while (idx < elems) {
+		size_t ofs = idx == elem_idx (start) ? start % ELEM_BITS : 0;
+		elem_type e;
+
+		if (run_len == 0) {
+			/* Skip elements with no bit equal to VALUE. */
+			size_t next = next_summary (b, has_value, idx);
+			if (next != idx) {
+				idx = next;
+				continue;
+			}
+		} else if (ofs == 0) {
+			/* Extend the run across elements that are all VALUE. */
+			size_t next = next_summary (b, has_other, idx);
+			size_t end = next * ELEM_BITS;
+			run_len += (end < b->bit_cnt ? end : b->bit_cnt) - idx * ELEM_BITS;
+			if (run_len >= cnt)
+				return run_start;
+			if (next >= elems)
+				break;
+			idx = next;
+		}
+
+		/* Walk the runs within this element. */
+		e = value_bits (b, idx, value) >> ofs;
+		while (ofs < ELEM_BITS) {
+			if (e & 1) {
+				/* A run of VALUE bits starts or continues here. */
+				size_t len = ~e == 0 ? ELEM_BITS - ofs : (size_t) lowest_bit (~e);
+				if (len > ELEM_BITS - ofs)
+					len = ELEM_BITS - ofs;
+				if (run_len == 0)
+					run_start = idx * ELEM_BITS + ofs;
+				run_len += len;
+				if (run_len >= cnt)
+					return run_start;
+				ofs += len;
+				if (ofs < ELEM_BITS) {
+					run_len = 0;
+					e >>= len;
+				}
+			} else {
+				/* Skip to the next VALUE bit, if any. */
+				run_len = 0;
+				if (e == 0)
+					break;
+				ofs += lowest_bit (e);
+				e >>= lowest_bit (e);
+			}
+		}
+		idx++;
 	}
 	return BITMAP_ERROR;
 }
@@ -296,6 +513,29 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
 		bitmap_set_multiple (b, idx, cnt, !value);
 	return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but starts looking where the last
+   successful call left off and wraps around to the beginning,
+   rather than always starting at a fixed index.  This "next fit"
+   spreads allocations across B instead of crowding the front,
+   and skips the front region that earlier allocations filled. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) {
+	size_t idx;
+
+	ASSERT (b != NULL);
+
+	if (b->cursor > b->bit_cnt)
+		b->cursor = 0;
+	idx = bitmap_scan (b, b->cursor, cnt, value);
+	if (idx == BITMAP_ERROR && b->cursor != 0)
+		idx = bitmap_scan (b, 0, cnt, value);
+	if (idx != BITMAP_ERROR) {
+		bitmap_set_multiple (b, idx, cnt, !value);
+		b->cursor = idx + cnt;
+	}
+	return idx;
+}
 
 /* File input and output. */
 
@@ -311,10 +551,13 @@ bitmap_file_size (const struct bitmap *b) {
 bool
 bitmap_read (struct bitmap *b, struct file *file) {
 	bool success = true;
+	size_t i;
 	if (b->bit_cnt > 0) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+			update_summary (b, i);
 	}
 	return success;
 }
@@ -0,0 +1,193 @@
+/* LZ77 compression in the style of LZ4.
+
+   The compressed form is a sequence of runs.  Each run is a token
+   byte, then the literal bytes the token announces, then, except
+   in the last run, a 2-byte little-endian offset back into the
+   output from which to copy a match.  The token's high nibble is
+   the number of literals and its low nibble the match length
+   minus LZ_MIN_MATCH; a nibble of 15 is followed by bytes that
+   are added to it, each 255 meaning that another one follows.
+
+   The compressor looks for matches through a table of the last
+   position at which each hash of 4 bytes was seen, and takes the
+   first match it finds without looking for a longer one.  That
+   makes it fast rather than thorough, which is the right trade
+   for compressing pages on their way out of memory.
+
+   Inputs must be shorter than 64 kB, so that every position fits
+   the table and every offset fits 2 bytes. */
+
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Shortest match worth encoding. */
+#define LZ_MIN_MATCH 4
+
+/* Largest value of a token nibble. */
+#define NIBBLE_MAX 15
+
+/* Reads 4 bytes at P, which need not be aligned. */
+static inline uint32_t
+read32 (const uint8_t *p) {
+	uint32_t x;
+
+	memcpy (&x, p, sizeof x);
+	return x;
+}
+
+/* Returns the match table index for the 4 bytes X. */
+static inline size_t
+hash32 (uint32_t x) {
+	return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extra length bytes for LEN, whose nibble said 15, at
+   *OP, which must stay below OEND.  Returns false if they do not
+   fit. */
+static bool
+put_length (uint8_t **op, uint8_t *oend, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (*op >= oend)
+			return false;
+		*(*op)++ = 255;
+	}
+	if (*op >= oend)
+		return false;
+	*(*op)++ = len;
+	return true;
+}
+
+/* Writes a run of LIT_CNT literals from LIT followed, if MATCH_LEN
+   is nonzero, by a match of MATCH_LEN bytes OFFSET bytes back.
+   Returns false if it does not fit before OEND. */
+static bool
+put_run (uint8_t **op, uint8_t *oend, const uint8_t *lit, size_t lit_cnt,
+		size_t offset, size_t match_len) {
+	size_t m = match_len != 0 ? match_len - LZ_MIN_MATCH : 0;
+	uint8_t *token = *op;
+
+	if (*op >= oend)
+		return false;
+	*token = (lit_cnt < NIBBLE_MAX ? lit_cnt : NIBBLE_MAX) << 4
+		| (m < NIBBLE_MAX ? m : NIBBLE_MAX);
+	(*op)++;
+
+	if (lit_cnt >= NIBBLE_MAX && !put_length (op, oend, lit_cnt - NIBBLE_MAX))
+		return false;
+	if ((size_t) (oend - *op) < lit_cnt)
+		return false;
+	memcpy (*op, lit, lit_cnt);
+	*op += lit_cnt;
+
+	if (match_len == 0)
+		return true;
+	if (oend - *op < 2)
+		return false;
+	*(*op)++ = offset;
+	*(*op)++ = offset >> 8;
+	return m < NIBBLE_MAX || put_length (op, oend, m - NIBBLE_MAX);
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into DST, which has room
+   for DST_SIZE bytes, using WORK as scratch space.  Returns the
+   compressed size, or 0 if it would exceed DST_SIZE. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+		void *dst_, size_t dst_size, uint16_t work[LZ_HASH_SIZE]) {
+	const uint8_t *src = src_;
+	const uint8_t *end = src + src_size;
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	uint8_t *op = dst_;
+	uint8_t *oend = op + dst_size;
+
+	ASSERT (src_size <= UINT16_MAX);
+
+	memset (work, 0, sizeof *work * LZ_HASH_SIZE);
+	while (end - ip >= LZ_MIN_MATCH) {
+		uint32_t seq = read32 (ip);
+		size_t h = hash32 (seq);
+		const uint8_t *ref = src + work[h];
+
+		work[h] = ip - src;
+		if (ref < ip && read32 (ref) == seq) {
+			const uint8_t *m = ip + LZ_MIN_MATCH;
+			const uint8_t *r = ref + LZ_MIN_MATCH;
+
+			while (m < end && *m == *r) {
+				m++;
+				r++;
+			}
+			if (!put_run (&op, oend, anchor, ip - anchor, ip - ref, m - ip))
+				return 0;
+			ip = anchor = m;
+		} else
+			ip++;
+	}
+	if (!put_run (&op, oend, anchor, end - anchor, 0, 0))
+		return 0;
+	return op - (uint8_t *) dst_;
+}
+
+/* Reads an extended length at *IP, which must stay below IEND,
+   and adds it to *LEN.  Returns false if the input ends first. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into the DST_SIZE bytes at DST.  Returns true if
+   SRC is well formed and decompresses to exactly DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t src_size,
+		void *dst_, size_t dst_size) {
+	const uint8_t *ip = src_;
+	const uint8_t *iend = ip + src_size;
+	uint8_t *dst = dst_;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit_cnt = token >> 4;
+		size_t match_len = token & NIBBLE_MAX;
+		size_t offset;
+		const uint8_t *ref;
+
+		if (lit_cnt == NIBBLE_MAX && !get_length (&ip, iend, &lit_cnt))
+			return false;
+		if ((size_t) (iend - ip) < lit_cnt || (size_t) (oend - op) < lit_cnt)
+			return false;
+		memcpy (op, ip, lit_cnt);
+		ip += lit_cnt;
+		op += lit_cnt;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (match_len == NIBBLE_MAX && !get_length (&ip, iend, &match_len))
+			return false;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| (size_t) (oend - op) < match_len)
+			return false;
+
+		/* Byte by byte, since the match may overlap its own output. */
+		for (ref = op - offset; match_len-- > 0; )
+			*op++ = *ref++;
+	}
+	return op == oend;
+}
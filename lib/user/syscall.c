@@ -25,7 +25,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			"syscall\n"
 			: "=a" (ret)
 			: "g" (num), "g" (a1), "g" (a2), "g" (a3), "g" (a4), "g" (a5), "g" (a6)
-			: "cc", "memory");ㅌㅌㅌㅌㅌㅌㅌ
+			: "cc", "memory");
 	return ret;
 }
 
@@ -145,6 +145,16 @@ dup2 (int oldfd, int newfd){
 	return syscall2 (SYS_DUP2, oldfd, newfd);
 }
 
+int
+poll (struct pollfd *fds, unsigned nfds, int timeout) {
+	return syscall3 (SYS_POLL, fds, nfds, timeout);
+}
+
+int
+memprof (void) {
+	return syscall0 (SYS_MEMPROF);
+}
+
 void *
 mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
 	return (void *) syscall5 (SYS_MMAP, addr, length, writable, fd, offset);
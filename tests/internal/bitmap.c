@@ -0,0 +1,132 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), and bitmap_contains()
+   against straightforward bit-at-a-time versions on random
+   bitmaps, then times the word-at-a-time scan against the
+   bit-at-a-time one on a large, mostly full bitmap, which is the
+   case the summary words are meant to speed up.  Run from the
+   kernel command line as "run bitmap". */
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <intrinsic.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Largest bitmap to check, in bits. */
+#define MAX_BITS 700
+
+/* Size of the bitmap to time, in bits, and number of scans. */
+#define BENCH_BITS 65536
+#define BENCH_SCANS 100
+
+static size_t naive_scan (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static void check_random (size_t bit_cnt);
+static void bench (void);
+
+/* Test the bitmap implementation. */
+void
+test_bitmap (void) 
+{
+  size_t bit_cnt;
+
+  printf ("testing bitmaps of various sizes:");
+  for (bit_cnt = 0; bit_cnt < MAX_BITS; bit_cnt += 1 + bit_cnt / 8) 
+    {
+      printf (" %zu", bit_cnt);
+      check_random (bit_cnt);
+    }
+  printf (" done\n");
+
+  bench ();
+}
+
+/* Fills a bitmap of BIT_CNT bits with random runs and compares
+   the word-at-a-time operations against naive versions. */
+static void
+check_random (size_t bit_cnt) 
+{
+  struct bitmap *b = bitmap_create (bit_cnt);
+  int repeat;
+
+  ASSERT (b != NULL);
+  for (repeat = 0; repeat < 50; repeat++) 
+    {
+      size_t start = bit_cnt ? random_ulong () % bit_cnt : 0;
+      size_t cnt = random_ulong () % (bit_cnt - start + 1);
+      bool value = random_ulong () % 2;
+      size_t i, ones;
+
+      bitmap_set_multiple (b, start, cnt, random_ulong () % 3 != 0);
+
+      cnt = random_ulong () % (bit_cnt / 4 + 2);
+      ASSERT (bitmap_scan (b, start, cnt, value)
+              == (cnt ? naive_scan (b, start, cnt, value) : start));
+
+      cnt = bit_cnt - start;
+      ones = 0;
+      for (i = start; i < bit_cnt; i++)
+        ones += bitmap_test (b, i);
+      ASSERT (bitmap_count (b, start, cnt, true) == ones);
+      ASSERT (bitmap_count (b, start, cnt, false) == cnt - ones);
+      ASSERT (bitmap_contains (b, start, cnt, true) == (ones > 0));
+      ASSERT (bitmap_contains (b, start, cnt, false) == (ones < cnt));
+    }
+  bitmap_destroy (b);
+}
+
+/* Times bitmap_scan() against naive_scan() looking for a run of
+   free bits near the end of a bitmap that is otherwise full. */
+static void
+bench (void) 
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  uint64_t start, fast, slow;
+  size_t expect;
+  int i;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  for (i = 0; i < BENCH_BITS; i += 97)
+    bitmap_reset (b, i);
+  bitmap_set_multiple (b, BENCH_BITS - 64, 16, false);
+  expect = BENCH_BITS - 64;
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    ASSERT (bitmap_scan (b, 0, 16, false) == expect);
+  fast = (rdtsc () - start) / BENCH_SCANS;
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    ASSERT (naive_scan (b, 0, 16, false) == expect);
+  slow = (rdtsc () - start) / BENCH_SCANS;
+
+  printf ("scan of %d bits: %"PRIu64" cycles word-at-a-time, "
+          "%"PRIu64" cycles bit-at-a-time\n", BENCH_BITS, fast, slow);
+  bitmap_destroy (b);
+}
+
+/* Returns the index of the first run of CNT bits set to VALUE
+   in B at or after START, testing one bit at a time, or
+   BITMAP_ERROR if there is none. */
+static size_t
+naive_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t bit_cnt = bitmap_size (b);
+  size_t i, j;
+
+  for (i = start; cnt <= bit_cnt && i <= bit_cnt - cnt; i++) 
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
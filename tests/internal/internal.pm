@@ -0,0 +1,15 @@
+sub check_internal {
+    our ($test);
+    my ($name) = $test =~ m%([^/]+)$%;
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    # Timings vary from run to run, so only check that the test
+    # got to the end without a failed assertion.
+    fail "Run didn't finish: no \"($name) end\" message\n"
+      if !grep (/^\($name\) end$/, @output);
+    pass;
+}
+
+1;
@@ -0,0 +1,162 @@
+/* Test program for lib/kernel/lz.c.
+
+   Compresses pages of several kinds, from all zeros to random
+   bytes, checks that each decompresses back to the original and
+   that a truncated or corrupted stream is rejected rather than
+   overrunning the output, then times compression and
+   decompression of each kind.  Run from the kernel command line
+   as "run lz". */
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <intrinsic.h>
+#include <lz.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/vaddr.h"
+
+/* Kinds of page to compress. */
+enum kind
+  {
+    ZEROS,              /* All zeros. */
+    SPARSE,             /* Mostly zeros, a few random words. */
+    TEXT,               /* Words from a small vocabulary. */
+    POINTERS,           /* Nearby 64-bit values, as in a heap. */
+    RANDOM,             /* Random bytes. */
+    KIND_CNT
+  };
+
+static const char *kind_names[KIND_CNT] =
+  {"zeros", "sparse", "text", "pointers", "random"};
+
+static uint8_t page[PGSIZE];
+static uint8_t packed[PGSIZE + PGSIZE / 8];
+static uint8_t unpacked[PGSIZE + 16];
+static uint16_t work[LZ_HASH_SIZE];
+
+static void fill (enum kind);
+static void check (enum kind);
+static void bench (enum kind);
+
+/* Test the compressor. */
+void
+test_lz (void)
+{
+  enum kind k;
+  int i;
+
+  printf ("testing lz:");
+  for (k = 0; k < KIND_CNT; k++)
+    {
+      printf (" %s", kind_names[k]);
+      for (i = 0; i < 16; i++)
+        check (k);
+    }
+  printf (" done\n");
+
+  printf ("compressed size, cycles to compress/decompress:\n");
+  for (k = 0; k < KIND_CNT; k++)
+    bench (k);
+}
+
+/* Fills PAGE with data of kind K. */
+static void
+fill (enum kind k)
+{
+  static const char *words[] = {"the ", "page ", "frame ", "swap ",
+                                "disk ", "of ", "a ", "to "};
+  size_t ofs, i;
+
+  switch (k)
+    {
+    case ZEROS:
+      memset (page, 0, PGSIZE);
+      break;
+
+    case SPARSE:
+      memset (page, 0, PGSIZE);
+      for (i = 0; i < 16; i++)
+        ((uint32_t *) page)[random_ulong () % (PGSIZE / 4)] = random_ulong ();
+      break;
+
+    case TEXT:
+      for (ofs = 0; ofs < PGSIZE; )
+        {
+          const char *w = words[random_ulong () % 8];
+          size_t n = strlen (w);
+          if (n > PGSIZE - ofs)
+            n = PGSIZE - ofs;
+          memcpy (page + ofs, w, n);
+          ofs += n;
+        }
+      break;
+
+    case POINTERS:
+      for (i = 0; i < PGSIZE / 8; i++)
+        ((uint64_t *) page)[i] = 0x8004200000 + (random_ulong () % 64) * 16;
+      break;
+
+    case RANDOM:
+    default:
+      random_bytes (page, PGSIZE);
+      break;
+    }
+}
+
+/* Compresses a page of kind K and checks the round trip, an
+   output buffer too small to hold the result, and damaged
+   input. */
+static void
+check (enum kind k)
+{
+  size_t size;
+
+  fill (k);
+  size = lz_compress (page, PGSIZE, packed, sizeof packed, work);
+  ASSERT (size > 0);
+
+  /* Round trip, checking that nothing past the page changes. */
+  memset (unpacked, 0xa5, sizeof unpacked);
+  ASSERT (lz_decompress (packed, size, unpacked, PGSIZE));
+  ASSERT (!memcmp (page, unpacked, PGSIZE));
+  ASSERT (unpacked[PGSIZE] == 0xa5);
+
+  /* Not enough room for the output. */
+  ASSERT (lz_compress (page, PGSIZE, packed, size - 1, work) == 0);
+
+  /* Truncated and corrupted input must not overrun. */
+  ASSERT (!lz_decompress (packed, size - 1, unpacked, PGSIZE)
+          || memcmp (page, unpacked, PGSIZE));
+  packed[random_ulong () % size] ^= 1 << (random_ulong () % 8);
+  lz_decompress (packed, size, unpacked, PGSIZE);
+  ASSERT (unpacked[PGSIZE] == 0xa5);
+}
+
+/* Calls to time for each kind. */
+#define BENCH_CALLS 16
+
+/* Times compressing and decompressing a page of kind K. */
+static void
+bench (enum kind k)
+{
+  uint64_t start, comp, decomp;
+  size_t size = 0;
+  int i;
+
+  fill (k);
+  start = rdtsc ();
+  for (i = 0; i < BENCH_CALLS; i++)
+    size = lz_compress (page, PGSIZE, packed, sizeof packed, work);
+  comp = (rdtsc () - start) / BENCH_CALLS;
+
+  start = rdtsc ();
+  for (i = 0; i < BENCH_CALLS; i++)
+    lz_decompress (packed, size, unpacked, PGSIZE);
+  decomp = (rdtsc () - start) / BENCH_CALLS;
+
+  printf ("  %-8s %4zu bytes, %"PRIu64"/%"PRIu64"\n",
+          kind_names[k], size, comp, decomp);
+}
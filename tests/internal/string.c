@@ -0,0 +1,235 @@
+/* Test program for the block routines in lib/string.c.
+
+   Checks memcpy(), memmove(), memset(), memcmp(), memchr(), and
+   strlen() against straightforward byte-at-a-time versions at
+   every combination of small sizes and misalignments, then times
+   both across a range of sizes and alignments.  Run from the
+   kernel command line as "run string". */
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <intrinsic.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+
+/* Largest block to check, in bytes. */
+#define MAX_CHECK 80
+
+/* Buffers, big enough for the largest timed block plus slack
+   for misalignment. */
+#define BUF_SIZE (4096 + 64)
+static unsigned char buf_a[BUF_SIZE];
+static unsigned char buf_b[BUF_SIZE];
+static unsigned char buf_c[BUF_SIZE];
+
+static void *naive_memcpy (void *, const void *, size_t);
+static void *naive_memset (void *, int, size_t);
+static int naive_memcmp (const void *, const void *, size_t);
+static void *naive_memchr (const void *, int, size_t);
+static size_t naive_strlen (const char *);
+static void check (size_t size, size_t dst_ofs, size_t src_ofs);
+static void bench (size_t size, size_t ofs);
+
+/* Test the string routines. */
+void
+test_string (void)
+{
+  static const size_t sizes[] = {8, 64, 512, 4096};
+  size_t size, dst_ofs, src_ofs;
+  size_t i;
+
+  printf ("testing string routines:");
+  for (size = 0; size <= MAX_CHECK; size++)
+    {
+      if (size % 16 == 0)
+        printf (" %zu", size);
+      for (dst_ofs = 0; dst_ofs < 8; dst_ofs++)
+        for (src_ofs = 0; src_ofs < 8; src_ofs++)
+          check (size, dst_ofs, src_ofs);
+    }
+  printf (" done\n");
+
+  printf ("cycles per call, fast/naive:\n");
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      bench (sizes[i], 0);
+      bench (sizes[i], 3);
+    }
+}
+
+/* Fills the buffers with random bytes that are never zero. */
+static void
+fill_random (void)
+{
+  size_t i;
+
+  for (i = 0; i < BUF_SIZE; i++)
+    buf_a[i] = buf_b[i] = buf_c[i] = random_ulong () % 255 + 1;
+}
+
+/* Checks each routine on a block of SIZE bytes, with the
+   destination at DST_OFS and the source at SRC_OFS bytes past a
+   word boundary. */
+static void
+check (size_t size, size_t dst_ofs, size_t src_ofs)
+{
+  unsigned char *a = buf_a + src_ofs;
+  unsigned char *b = buf_b + dst_ofs;
+  unsigned char *c = buf_c + dst_ofs;
+  unsigned char ch;
+  int x, y;
+
+  /* memcpy(), checking that nothing outside the block changes. */
+  fill_random ();
+  ASSERT (memcpy (b, a, size) == b);
+  naive_memcpy (c, a, size);
+  ASSERT (!naive_memcmp (buf_b, buf_c, BUF_SIZE));
+
+  /* memmove(), in both directions within one buffer. */
+  fill_random ();
+  ASSERT (memmove (buf_b + dst_ofs, buf_b + src_ofs, size)
+          == buf_b + dst_ofs);
+  if (dst_ofs < src_ofs)
+    naive_memcpy (buf_c + dst_ofs, buf_c + src_ofs, size);
+  else if (dst_ofs > src_ofs)
+    {
+      size_t i;
+      for (i = size; i-- > 0; )
+        buf_c[dst_ofs + i] = buf_c[src_ofs + i];
+    }
+  ASSERT (!naive_memcmp (buf_b, buf_c, BUF_SIZE));
+
+  /* memset(). */
+  ch = random_ulong ();
+  ASSERT (memset (b, ch, size) == b);
+  naive_memset (c, ch, size);
+  ASSERT (!naive_memcmp (buf_b, buf_c, BUF_SIZE));
+
+  /* memcmp(), on equal blocks and then on blocks that differ in
+     one random byte. */
+  fill_random ();
+  ASSERT (memcmp (a, buf_b + dst_ofs, 0) == 0);
+  naive_memcpy (b, a, size);
+  ASSERT (memcmp (a, b, size) == 0);
+  if (size > 0)
+    {
+      b[random_ulong () % size] = random_ulong ();
+      x = memcmp (a, b, size);
+      y = naive_memcmp (a, b, size);
+      ASSERT ((x < 0) == (y < 0) && (x > 0) == (y > 0));
+    }
+
+  /* memchr(), for a byte that is present and one that is not. */
+  ch = size > 0 ? a[random_ulong () % size] : 1;
+  ASSERT (memchr (a, ch, size) == naive_memchr (a, ch, size));
+  ASSERT (memchr (a, 0, size) == NULL);
+
+  /* strlen(). */
+  a[size] = '\0';
+  ASSERT (strlen ((char *) a) == size);
+  ASSERT (strlen ((char *) a) == naive_strlen ((char *) a));
+}
+
+/* Calls to time for each routine and size. */
+#define BENCH_CALLS 64
+
+/* Times STMT, run BENCH_CALLS times, and returns the average
+   number of cycles per run. */
+#define TIME(STMT)                                      \
+        ({                                              \
+          uint64_t start_ = rdtsc ();                   \
+          int i_;                                       \
+          for (i_ = 0; i_ < BENCH_CALLS; i_++)          \
+            (void) (STMT);                              \
+          (rdtsc () - start_) / BENCH_CALLS;            \
+        })
+
+/* Times each routine against its naive version on blocks of
+   SIZE bytes that start OFS bytes past a word boundary. */
+static void
+bench (size_t size, size_t ofs)
+{
+  unsigned char *a = buf_a + ofs;
+  unsigned char *b = buf_b + ofs;
+
+  fill_random ();
+  a[size] = '\0';
+  naive_memcpy (b, a, size + 1);
+
+  printf ("  %4zu bytes +%zu: memcpy %"PRIu64"/%"PRIu64
+          ", memset %"PRIu64"/%"PRIu64
+          ", memcmp %"PRIu64"/%"PRIu64
+          ", memchr %"PRIu64"/%"PRIu64
+          ", strlen %"PRIu64"/%"PRIu64"\n",
+          size, ofs,
+          TIME (memcpy (b, a, size)),
+          TIME (naive_memcpy (b, a, size)),
+          TIME (memset (b, 1, size)),
+          TIME (naive_memset (b, 1, size)),
+          TIME (memcmp (a, a, size)),
+          TIME (naive_memcmp (a, a, size)),
+          TIME (memchr (a, 0, size)),
+          TIME (naive_memchr (a, 0, size)),
+          TIME (strlen ((char *) a)),
+          TIME (naive_strlen ((char *) a)));
+}
+
+/* Byte-at-a-time versions, as lib/string.c used to have. */
+
+static void *
+naive_memcpy (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+  return dst_;
+}
+
+static void *
+naive_memset (void *dst_, int value, size_t size)
+{
+  unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+  return dst_;
+}
+
+static int
+naive_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static void *
+naive_memchr (const void *block_, int ch_, size_t size)
+{
+  const unsigned char *block = block_;
+  unsigned char ch = ch_;
+
+  for (; size-- > 0; block++)
+    if (*block == ch)
+      return (void *) block;
+  return NULL;
+}
+
+static size_t
+naive_strlen (const char *string)
+{
+  const char *p;
+
+  for (p = string; *p != '\0'; p++)
+    continue;
+  return p - string;
+}
@@ -0,0 +1,4 @@
+# -*- perl -*-
+use tests::tests;
+use tests::internal::internal;
+check_internal ();
@@ -0,0 +1,46 @@
+/* Polls descriptors in each state poll() distinguishes: a file
+   descriptor that is not open, stdin with no input waiting,
+   stdout, and an open file.  Also checks that a timeout of 0
+   returns at once and that a positive timeout expires when
+   nothing becomes ready; if either blocked, the test would time
+   out. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct pollfd fds[2];
+  int handle;
+
+  fds[0].fd = 42;
+  fds[0].events = POLLIN;
+  fds[1].fd = -1;
+  fds[1].events = POLLOUT;
+  CHECK (poll (fds, 2, 0) == 2, "poll fds that are not open");
+  CHECK (fds[0].revents == POLLNVAL && fds[1].revents == POLLNVAL,
+         "both report POLLNVAL");
+
+  fds[0].fd = STDIN_FILENO;
+  fds[0].events = POLLIN;
+  CHECK (poll (fds, 1, 0) == 0, "poll stdin, timeout 0");
+  CHECK (fds[0].revents == 0, "stdin not ready");
+  CHECK (poll (fds, 1, 100) == 0, "poll stdin, timeout 100 ms");
+  CHECK (fds[0].revents == 0, "stdin still not ready");
+
+  fds[1].fd = STDOUT_FILENO;
+  fds[1].events = POLLIN | POLLOUT;
+  CHECK (poll (fds, 2, -1) == 1, "poll stdin and stdout, no timeout");
+  CHECK (fds[0].revents == 0 && fds[1].revents == POLLOUT,
+         "stdout ready for writing");
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  fds[0].fd = handle;
+  fds[0].events = POLLIN | POLLOUT;
+  CHECK (poll (fds, 1, -1) == 1, "poll \"sample.txt\"");
+  CHECK (fds[0].revents == (POLLIN | POLLOUT),
+         "\"sample.txt\" ready for reading and writing");
+}
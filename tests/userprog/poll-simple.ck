@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(poll-simple) begin
+(poll-simple) poll fds that are not open
+(poll-simple) both report POLLNVAL
+(poll-simple) poll stdin, timeout 0
+(poll-simple) stdin not ready
+(poll-simple) poll stdin, timeout 100 ms
+(poll-simple) stdin still not ready
+(poll-simple) poll stdin and stdout, no timeout
+(poll-simple) stdout ready for writing
+(poll-simple) open "sample.txt"
+(poll-simple) poll "sample.txt"
+(poll-simple) "sample.txt" ready for reading and writing
+(poll-simple) end
+poll-simple: exit(0)
+EOF
+pass;
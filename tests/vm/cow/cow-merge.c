@@ -0,0 +1,110 @@
+/* Run with -merge.  Forks several children that each fill the
+   same buffer with identical contents, a quarter of the pages all
+   zeros, so that the kernel can merge their pages with each other
+   and with the parent's.  Each child then reads a file, to give
+   the merge thread time to run, and checks that its data is
+   unchanged.  Then it writes different data to every page, which
+   must separate it from the others again, reads the file once
+   more, and checks both that it sees its own writes and that the
+   parent still sees the original data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 32
+#define CHILD_CNT 3
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Returns the byte that page I of BUF should be filled with for
+   process number ID, where 0 is the shared pattern. */
+static char
+page_byte (int id, int i)
+{
+	if (id == 0)
+		return i % 4 == 0 ? 0 : 'a' + i % 4;
+	return 'A' + id * 4 + i % 4;
+}
+
+/* Fills every page of BUF for process number ID. */
+static void
+fill (int id)
+{
+	int i;
+
+	for (i = 0; i < PAGE_CNT; i++)
+		memset (buf + i * PAGE_SIZE, page_byte (id, i), PAGE_SIZE);
+}
+
+/* Returns true if every byte of BUF is as fill(ID) left it. */
+static bool
+verify (int id)
+{
+	int i, j;
+
+	for (i = 0; i < PAGE_CNT; i++)
+		for (j = 0; j < PAGE_SIZE; j++)
+			if (buf[i * PAGE_SIZE + j] != page_byte (id, i))
+				return false;
+	return true;
+}
+
+/* Reads through "large.txt", blocking on the disk. */
+static void
+read_file (void)
+{
+	char block[512];
+	int handle = open ("large.txt");
+
+	if (handle < 0)
+		exit (1);
+	while (read (handle, block, sizeof block) > 0)
+		continue;
+	close (handle);
+}
+
+/* Child process number ID.  Exits with 0 on success, or a
+   nonzero code saying which check failed. */
+static void
+child (int id)
+{
+	fill (0);
+	read_file ();
+	if (!verify (0))
+		exit (2);
+
+	fill (id);
+	read_file ();
+	if (!verify (id))
+		exit (3);
+	exit (0);
+}
+
+void
+test_main (void)
+{
+	pid_t children[CHILD_CNT];
+	int i;
+
+	fill (0);
+	for (i = 0; i < CHILD_CNT; i++)
+	{
+		children[i] = fork ("child");
+		if (children[i] == 0)
+			child (i + 1);
+		CHECK (children[i] > 0, "fork child %d", i + 1);
+	}
+
+	read_file ();
+	CHECK (verify (0), "check data consistency");
+
+	for (i = 0; i < CHILD_CNT; i++)
+		CHECK (wait (children[i]) == 0, "wait for child %d", i + 1);
+
+	CHECK (verify (0), "check data after children wrote");
+	fill (CHILD_CNT + 1);
+	CHECK (verify (CHILD_CNT + 1), "check data change");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-merge) begin
+(cow-merge) fork child 1
+(cow-merge) fork child 2
+(cow-merge) fork child 3
+(cow-merge) check data consistency
+(cow-merge) wait for child 1
+(cow-merge) wait for child 2
+(cow-merge) wait for child 3
+(cow-merge) check data after children wrote
+(cow-merge) check data change
+(cow-merge) end
+EOF
+pass;
@@ -17,8 +17,11 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memprof.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/slab.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
 #ifdef USERPROG
@@ -41,6 +44,9 @@
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
 
+/* Amount of physical memory, in 4 kB pages. */
+size_t ram_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -84,7 +90,11 @@ main (void) {
 
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
+	ram_pages = mem_end / PGSIZE;
+	memprof_init ();
+	shrinker_init ();
 	malloc_init ();
+	slab_init ();
 	paging_init (mem_end);
 
 #ifdef USERPROG
@@ -142,7 +152,15 @@ bss_init (void) {
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Memory is mapped in 2 MB pages, each with a single PDE, except
+ * for the 2 MB regions that hold kernel text, which must be
+ * read-only while the data next to it is writable, and the tail
+ * of memory past the last whole 2 MB.  Those use 4 kB pages.
+ * 1 GB pages would need the direct map's virtual and physical
+ * addresses to be equal modulo 1 GB, but LOADER_KERN_BASE is only
+ * 2 MB aligned, so they are never used here. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
@@ -150,17 +168,28 @@ paging_init (uint64_t mem_end) {
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = (uint64_t) &start;
+	uint64_t text_end = (uint64_t) &_end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (pa % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (va + LARGE_PGSIZE <= text_start || va >= text_end)) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += LARGE_PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
+		if (text_start <= va && va < text_end)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
@@ -221,11 +250,27 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-irqsoff"))
+			intr_irqsoff_trace = true;
+		else if (!strcmp (name, "-memprof"))
+			memprof_enabled = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-merge"))
+			merge_scan_pages = atoi (value);
+		else if (!strcmp (name, "-merge-ms"))
+			merge_scan_ms = atoi (value);
+		else if (!strcmp (name, "-rss-limit"))
+			rss_limit = atoi (value);
+		else if (!strcmp (name, "-ws-ms"))
+			ws_sample_ms = atoi (value);
+		else if (!strcmp (name, "-rss-report"))
+			rss_report = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -326,8 +371,17 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -irqsoff           Report the longest interrupts-off intervals.\n"
+			"  -memprof           Report kernel memory use by call site.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -merge=COUNT       Scan COUNT pages per pass for identical ones.\n"
+			"  -merge-ms=MS       Sleep MS milliseconds between merge passes.\n"
+			"  -rss-limit=COUNT   Limit each process to COUNT resident pages.\n"
+			"  -ws-ms=MS          Sample working sets every MS ms, 0 for never.\n"
+			"  -rss-report        Print each process's memory use as it exits.\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +408,15 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	intr_print_stats ();
+	palloc_print_stats ();
+	malloc_stats ();
+	slab_print_stats ();
+	shrinker_print_stats ();
+	memprof_dump ();
+#ifdef VM
+	vm_print_stats ();
+#endif
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -110,6 +110,44 @@ static void pic_end_of_interrupt (int irq);
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 
+/* Interrupts-off latency tracer.
+
+   When enabled with the kernel command-line option "-irqsoff",
+   every transition from interrupts-on to interrupts-off and back
+   is timestamped with the TSC.  The longest intervals are kept
+   in a small table keyed by the pair of code addresses at which
+   the interval started and ended, and are reported by
+   intr_print_stats() at shutdown.  There is only one CPU, so a
+   single "off since" timestamp describes the whole machine. */
+bool intr_irqsoff_trace;
+
+/* Number of (start, end) pairs remembered by the tracer. */
+#define IRQSOFF_SLOTS 32
+
+/* Number of offenders printed at shutdown. */
+#define IRQSOFF_REPORT 10
+
+/* One interrupts-off call-site pair. */
+struct irqsoff_entry {
+	void *start_ip;             /* Where interrupts were turned off. */
+	void *end_ip;               /* Where they were turned back on. */
+	uint64_t max_cycles;        /* Longest interval seen. */
+	uint64_t total_cycles;      /* Sum of all intervals. */
+	uint64_t hits;              /* Number of intervals. */
+};
+
+static struct irqsoff_entry irqsoff_table[IRQSOFF_SLOTS];
+static bool irqsoff_active;     /* Is an interval being timed? */
+static uint64_t irqsoff_start;  /* TSC when it began. */
+static void *irqsoff_start_ip;  /* Code address where it began. */
+static uint64_t irqsoff_boot;   /* TSC at intr_init(), for calibration. */
+
+static void irqsoff_begin (void *ip);
+static void irqsoff_end (void *ip);
+
+static enum intr_level do_intr_enable (void *caller);
+static enum intr_level do_intr_disable (void *caller);
+
 /* Returns the current interrupt status. */
 enum intr_level
 intr_get_level (void) {
@@ -128,15 +166,32 @@ intr_get_level (void) {
    returns the previous interrupt status. */
 enum intr_level
 intr_set_level (enum intr_level level) {
-	return level == INTR_ON ? intr_enable () : intr_disable ();
+	void *caller = __builtin_return_address (0);
+	return level == INTR_ON ? do_intr_enable (caller) : do_intr_disable (caller);
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) {
+	return do_intr_enable (__builtin_return_address (0));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) {
+	return do_intr_disable (__builtin_return_address (0));
+}
+
+/* Enables interrupts on behalf of CALLER and returns the
+   previous interrupt status. */
+static enum intr_level
+do_intr_enable (void *caller) {
 	enum intr_level old_level = intr_get_level ();
 	ASSERT (!intr_context ());
 
+	if (old_level == INTR_OFF && intr_irqsoff_trace)
+		irqsoff_end (caller);
+
 	/* Enable interrupts by setting the interrupt flag.
 
 	   See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -146,9 +201,10 @@ intr_enable (void) {
 	return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) {
+/* Disables interrupts on behalf of CALLER and returns the
+   previous interrupt status. */
+static enum intr_level
+do_intr_disable (void *caller) {
 	enum intr_level old_level = intr_get_level ();
 
 	/* Disable interrupts by clearing the interrupt flag.
@@ -156,6 +212,9 @@ intr_disable (void) {
 	   Hardware Interrupts". */
 	asm volatile ("cli" : : : "memory");
 
+	if (old_level == INTR_ON && intr_irqsoff_trace)
+		irqsoff_begin (caller);
+
 	return old_level;
 }
 
@@ -166,6 +225,7 @@ intr_init (void) {
 
 	/* Initialize interrupt controller. */
 	pic_init ();
+	irqsoff_boot = rdtsc ();
 
 	/* Initialize IDT. */
 	for (i = 0; i < INTR_CNT; i++) {
@@ -262,11 +322,20 @@ intr_context (void) {
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
    returning from the interrupt.  May not be called at any other
-   time. */
+   time.  If the interrupted thread has preemption disabled, the
+   yield is deferred until it calls preempt_enable(). */
 void
 intr_yield_on_return (void) {
+	struct thread *t = thread_current ();
+
 	ASSERT (intr_context ());
-	yield_on_return = true;
+
+	/* The interrupted thread asked not to be preempted; let
+	   preempt_enable() yield on its behalf instead. */
+	if (t->preempt_count > 0)
+		t->preempt_pending = true;
+	else
+		yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -331,8 +400,17 @@ pic_end_of_interrupt (int irq) {
 void
 intr_handler (struct intr_frame *frame) {
 	bool external;
+	bool traced;
 	intr_handler_func *handler;
 
+	/* The CPU cleared IF on the way in through an interrupt gate,
+	   so an interrupts-off interval starts at the interrupted
+	   instruction. */
+	traced = intr_irqsoff_trace && (frame->eflags & FLAG_IF)
+		&& intr_get_level () == INTR_OFF;
+	if (traced)
+		irqsoff_begin ((void *) frame->rip);
+
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
 	   and they need to be acknowledged on the PIC (see below).
@@ -372,6 +450,10 @@ intr_handler (struct intr_frame *frame) {
 		if (yield_on_return)
 			thread_yield ();
 	}
+
+	/* The interval ends at iretq; charge it to the handler. */
+	if (traced && intr_get_level () == INTR_OFF)
+		irqsoff_end (handler != NULL ? (void *) handler : (void *) intr_handler);
 }
 
 /* Dumps interrupt frame F to the console, for debugging. */
@@ -403,3 +485,97 @@ const char *
 intr_name (uint8_t vec) {
 	return intr_names[vec];
 }
+
+/* Interrupts-off latency tracer. */
+
+/* Starts timing an interrupts-off interval that began at IP.
+   Interrupts must be off. */
+static void
+irqsoff_begin (void *ip) {
+	irqsoff_active = true;
+	irqsoff_start_ip = ip;
+	irqsoff_start = rdtsc ();
+}
+
+/* Finishes the interval being timed, which ends at IP, and
+   records it in irqsoff_table.  Interrupts must be off. */
+static void
+irqsoff_end (void *ip) {
+	struct irqsoff_entry *e, *victim = NULL;
+	uint64_t cycles;
+
+	if (!irqsoff_active)
+		return;
+	cycles = rdtsc () - irqsoff_start;
+	irqsoff_active = false;
+
+	for (e = irqsoff_table; e < irqsoff_table + IRQSOFF_SLOTS; e++) {
+		if (e->hits != 0 && e->start_ip == irqsoff_start_ip && e->end_ip == ip)
+			break;
+		if (victim == NULL || e->max_cycles < victim->max_cycles)
+			victim = e;
+	}
+
+	if (e == irqsoff_table + IRQSOFF_SLOTS) {
+		/* New pair.  Evict the pair with the shortest worst case,
+		   but only if this interval beats it. */
+		if (victim->hits != 0 && victim->max_cycles >= cycles)
+			return;
+		e = victim;
+		*e = (struct irqsoff_entry) {
+			.start_ip = irqsoff_start_ip,
+			.end_ip = ip,
+		};
+	}
+
+	e->hits++;
+	e->total_cycles += cycles;
+	if (cycles > e->max_cycles)
+		e->max_cycles = cycles;
+}
+
+/* Prints the longest interrupts-off intervals seen by the
+   tracer, worst first.  The addresses can be fed to the
+   `backtrace' utility. */
+void
+intr_print_stats (void) {
+	bool reported[IRQSOFF_SLOTS] = { false };
+	int64_t ticks;
+	uint64_t cycles_per_us = 0;
+	int i;
+
+	if (!intr_irqsoff_trace)
+		return;
+
+	/* Calibrate the TSC against the timer so that we can print
+	   microseconds as well as cycles. */
+	ticks = timer_ticks ();
+	if (ticks > 0)
+		cycles_per_us = (rdtsc () - irqsoff_boot) / ticks
+			* TIMER_FREQ / (1000 * 1000);
+
+	printf ("Interrupts-off intervals (worst first):\n");
+	for (i = 0; i < IRQSOFF_REPORT; i++) {
+		const struct irqsoff_entry *worst = NULL;
+		int j, worst_idx = 0;
+
+		for (j = 0; j < IRQSOFF_SLOTS; j++) {
+			const struct irqsoff_entry *e = &irqsoff_table[j];
+			if (!reported[j] && e->hits != 0
+					&& (worst == NULL || e->max_cycles > worst->max_cycles)) {
+				worst = e;
+				worst_idx = j;
+			}
+		}
+		if (worst == NULL)
+			break;
+		reported[worst_idx] = true;
+
+		printf ("  %'"PRIu64" cycles", worst->max_cycles);
+		if (cycles_per_us != 0)
+			printf (" (%'"PRIu64" us)", worst->max_cycles / cycles_per_us);
+		printf (", %'"PRIu64" hits, avg %'"PRIu64": %p -> %p\n",
+				worst->hits, worst->total_cycles / worst->hits,
+				worst->start_ip, worst->end_ip);
+	}
+}
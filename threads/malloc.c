@@ -1,19 +1,25 @@
 #include "threads/malloc.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memprof.h"
 #include "threads/palloc.h"
+#include "threads/shrinker.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  The classes are multiples of 16
+   bytes, spaced about 1.25x apart above 64 bytes (four per
+   doubling), so that no more than about a fifth of a block is
+   wasted.  The descriptor keeps a list of free blocks.  If
    the free list is nonempty, one of its blocks is used to
    satisfy the request.
 
@@ -26,20 +32,46 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator.  Each
+   descriptor keeps one such empty arena instead, so that a
+   workload hovering around an arena boundary does not allocate
+   and free a page every few calls; a shrinker gives it back when
+   memory runs out.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.  Such a
+   "big block" is resized in place when possible: realloc()
+   frees the pages a smaller size no longer needs, and asks the
+   page allocator for the pages just past the block when it must
+   grow, copying only if they are taken. */
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
+	struct arena *empty;        /* Kept arena with no used blocks. */
 	struct lock lock;           /* Lock. */
+
+	/* Statistics, protected by LOCK. */
+	size_t in_use;              /* Blocks handed out. */
+	uint64_t requests;          /* Calls satisfied from this class. */
+	uint64_t requested_bytes;   /* Bytes asked for by those calls. */
+};
+
+/* Big block statistics. */
+struct big_stats {
+	struct lock lock;           /* Lock. */
+	size_t in_use;              /* Big blocks handed out. */
+	uint64_t requests;          /* Big blocks allocated. */
+	uint64_t requested_bytes;   /* Bytes asked for. */
+	uint64_t allocated_bytes;   /* Bytes in the pages allocated. */
+	uint64_t grown;             /* Grown in place by realloc(). */
+	uint64_t shrunk;            /* Shrunk in place by realloc(). */
+	uint64_t moved;             /* Copied by realloc(). */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -57,32 +89,106 @@ struct block {
 	struct list_elem free_elem; /* Free list element. */
 };
 
+/* Granularity of size classes, in bytes. */
+#define CLASS_ALIGN 16
+
+/* Largest block that still fits twice in an arena. */
+#define MAX_BLOCK_SIZE \
+	ROUND_DOWN ((PGSIZE - sizeof (struct arena)) / 2, CLASS_ALIGN)
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[32];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Descriptor for each request size, indexed by the size divided
+   by CLASS_ALIGN, rounded up. */
+static struct desc *size_desc[MAX_BLOCK_SIZE / CLASS_ALIGN + 1];
+
+static struct big_stats big;
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *do_malloc (size_t size);
+static void *do_realloc (void *old_block, size_t new_size);
+static void *realloc_big (struct arena *, void *old_block, size_t new_size);
+static void big_count_request (size_t size, size_t page_cnt);
+static void arena_release (struct desc *, struct arena *);
+static size_t malloc_shrink_count (void *);
+static size_t malloc_shrink_scan (size_t page_cnt, void *);
+
+/* Releases kept empty arenas under memory pressure. */
+static struct shrinker malloc_shrinker = {
+	.name = "malloc",
+	.priority = SHRINK_PRI_ALLOC,
+	.count = malloc_shrink_count,
+	.scan = malloc_shrink_scan,
+};
+
+/* Returns the size class after BLOCK_SIZE: the next multiple of
+   CLASS_ALIGN up to 64 bytes, and beyond that a quarter of the
+   enclosing power of 2 further, so that each doubling holds four
+   classes about 1.25x apart. */
+static size_t
+next_class (size_t block_size) {
+	size_t pow2 = CLASS_ALIGN;
+
+	while (pow2 * 2 <= block_size)
+		pow2 *= 2;
+	return block_size + (pow2 / 4 > CLASS_ALIGN ? pow2 / 4 : CLASS_ALIGN);
+}
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) {
-	size_t block_size;
+	size_t block_size, i;
 
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
+	for (block_size = CLASS_ALIGN; block_size <= MAX_BLOCK_SIZE;
+			block_size = next_class (block_size)) {
 		struct desc *d = &descs[desc_cnt++];
 		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
 		d->block_size = block_size;
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
+		d->empty = NULL;
+		lock_init (&d->lock);
+	}
+
+	/* The last class is squeezed down to the largest block that
+	   still fits twice in an arena. */
+	if (descs[desc_cnt - 1].block_size < MAX_BLOCK_SIZE) {
+		struct desc *d = &descs[desc_cnt++];
+		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+		d->block_size = MAX_BLOCK_SIZE;
+		d->blocks_per_arena = 2;
+		list_init (&d->free_list);
+		d->empty = NULL;
 		lock_init (&d->lock);
 	}
+
+	for (i = 0; i < sizeof size_desc / sizeof *size_desc; i++) {
+		struct desc *d = descs;
+		while (d->block_size < i * CLASS_ALIGN)
+			d++;
+		size_desc[i] = d;
+	}
+
+	lock_init (&big.lock);
+	shrinker_register (&malloc_shrinker);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	void *p = do_malloc (size);
+
+	memprof_alloc (MEMPROF_MALLOC, p, size, __builtin_return_address (0));
+	return p;
+}
+
+/* Does the work of malloc(), without profiling. */
+static void *
+do_malloc (size_t size) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
@@ -93,14 +199,11 @@ malloc (size_t size) {
 
 	/* Find the smallest descriptor that satisfies a SIZE-byte
 	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
+	if (size > MAX_BLOCK_SIZE) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
+		a = palloc_get_multiple (PAL_NOPROF, page_cnt);
 		if (a == NULL)
 			return NULL;
 
@@ -109,8 +212,14 @@ malloc (size_t size) {
 		a->magic = ARENA_MAGIC;
 		a->desc = NULL;
 		a->free_cnt = page_cnt;
+
+		lock_acquire (&big.lock);
+		big.in_use++;
+		big_count_request (size, page_cnt);
+		lock_release (&big.lock);
 		return a + 1;
 	}
+	d = size_desc[DIV_ROUND_UP (size, CLASS_ALIGN)];
 
 	lock_acquire (&d->lock);
 
@@ -119,7 +228,7 @@ malloc (size_t size) {
 		size_t i;
 
 		/* Allocate a page. */
-		a = palloc_get_page (0);
+		a = palloc_get_page (PAL_NOPROF);
 		if (a == NULL) {
 			lock_release (&d->lock);
 			return NULL;
@@ -139,6 +248,11 @@ malloc (size_t size) {
 	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
 	a = block_to_arena (b);
 	a->free_cnt--;
+	if (a == d->empty)
+		d->empty = NULL;
+	d->in_use++;
+	d->requests++;
+	d->requested_bytes += size;
 	lock_release (&d->lock);
 	return b;
 }
@@ -156,9 +270,10 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = do_malloc (size);
 	if (p != NULL)
 		memset (p, 0, size);
+	memprof_alloc (MEMPROF_MALLOC, p, size, __builtin_return_address (0));
 
 	return p;
 }
@@ -181,11 +296,33 @@ block_size (void *block) {
    A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
 void *
 realloc (void *old_block, size_t new_size) {
+	void *new_block = do_realloc (old_block, new_size);
+
+	/* A moved block's old copy was already freed, and profiled as
+	   such, by free(). */
+	if (new_block != NULL && new_block == old_block)
+		memprof_resize (new_block, new_size);
+	else
+		memprof_alloc (MEMPROF_MALLOC, new_block, new_size,
+				__builtin_return_address (0));
+	return new_block;
+}
+
+/* Does the work of realloc(), without profiling the new block. */
+static void *
+do_realloc (void *old_block, size_t new_size) {
 	if (new_size == 0) {
 		free (old_block);
 		return NULL;
+	} else if (old_block != NULL && new_size > MAX_BLOCK_SIZE
+			&& block_to_arena (old_block)->desc == NULL) {
+		return realloc_big (block_to_arena (old_block), old_block, new_size);
+	} else if (old_block != NULL && new_size <= block_size (old_block)
+			&& block_to_arena (old_block)->desc != NULL) {
+		/* Still fits. */
+		return old_block;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = do_malloc (new_size);
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -205,6 +342,8 @@ free (void *p) {
 		struct arena *a = block_to_arena (b);
 		struct desc *d = a->desc;
 
+		memprof_free (p);
+
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
 
@@ -214,31 +353,170 @@ free (void *p) {
 #endif
 
 			lock_acquire (&d->lock);
+			d->in_use--;
 
 			/* Add block to free list. */
 			list_push_front (&d->free_list, &b->free_elem);
 
-			/* If the arena is now entirely unused, free it. */
+			/* If the arena is now entirely unused, keep it if we
+			   have no empty arena yet, otherwise free it. */
 			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
 				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+				if (d->empty == NULL)
+					d->empty = a;
+				else
+					arena_release (d, a);
 			}
 
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
+			lock_acquire (&big.lock);
+			big.in_use--;
+			lock_release (&big.lock);
 			palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
 }
 
+/* Resizes OLD_BLOCK, the big block in arena A, to NEW_SIZE
+   bytes, which is too big for any descriptor.  Returns the
+   resized block, or a null pointer if memory is not available,
+   in which case OLD_BLOCK is untouched. */
+static void *
+realloc_big (struct arena *a, void *old_block, size_t new_size) {
+	size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+	size_t old_cnt = a->free_cnt;
+	void *new_block;
+
+	if (page_cnt <= old_cnt) {
+		/* Give back the pages we no longer need. */
+		if (page_cnt < old_cnt) {
+			palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+					old_cnt - page_cnt);
+			a->free_cnt = page_cnt;
+		}
+		lock_acquire (&big.lock);
+		if (page_cnt < old_cnt)
+			big.shrunk++;
+		big_count_request (new_size, page_cnt);
+		lock_release (&big.lock);
+		return old_block;
+	}
+
+	if (palloc_grow_multiple (a, old_cnt, page_cnt)) {
+		a->free_cnt = page_cnt;
+		lock_acquire (&big.lock);
+		big.grown++;
+		big_count_request (new_size, page_cnt);
+		lock_release (&big.lock);
+		return old_block;
+	}
+
+	/* The following pages are taken, so move. */
+	new_block = do_malloc (new_size);
+	if (new_block != NULL) {
+		memcpy (new_block, old_block, block_size (old_block));
+		free (old_block);
+		lock_acquire (&big.lock);
+		big.moved++;
+		lock_release (&big.lock);
+	}
+	return new_block;
+}
+
+/* Counts a request for a big block of SIZE bytes, satisfied with
+   PAGE_CNT pages, whether by malloc() or by realloc() in place,
+   just as a realloc() that moves counts its malloc().  BIG.LOCK
+   must be held. */
+static void
+big_count_request (size_t size, size_t page_cnt) {
+	big.requests++;
+	big.requested_bytes += size;
+	big.allocated_bytes += page_cnt * PGSIZE - sizeof (struct arena);
+}
+
+/* Removes the blocks of A, an arena of D with no used blocks,
+   from D's free list and frees A.  D's lock must be held. */
+static void
+arena_release (struct desc *d, struct arena *a) {
+	size_t i;
+
+	for (i = 0; i < d->blocks_per_arena; i++) {
+		struct block *b = arena_to_block (a, i);
+		list_remove (&b->free_elem);
+	}
+	palloc_free_page (a);
+}
+
+/* Shrinker: counts the kept empty arenas. */
+static size_t
+malloc_shrink_count (void *aux UNUSED) {
+	struct desc *d;
+	size_t cnt = 0;
+
+	for (d = descs; d < descs + desc_cnt; d++)
+		cnt += d->empty != NULL;
+	return cnt;
+}
+
+/* Shrinker: frees up to PAGE_CNT kept empty arenas, skipping
+   descriptors whose lock is busy, including one that we hold
+   because malloc() is growing it. */
+static size_t
+malloc_shrink_scan (size_t page_cnt, void *aux UNUSED) {
+	struct desc *d;
+	size_t cnt = 0;
+
+	for (d = descs; cnt < page_cnt && d < descs + desc_cnt; d++)
+		if (d->empty != NULL && !lock_held_by_current_thread (&d->lock)
+				&& lock_try_acquire (&d->lock)) {
+			if (d->empty != NULL) {
+				arena_release (d, d->empty);
+				d->empty = NULL;
+				cnt++;
+			}
+			lock_release (&d->lock);
+		}
+	return cnt;
+}
+
+/* Prints how much memory each size class hands out and how much
+   of it goes unused. */
+void
+malloc_stats (void) {
+	struct desc *d;
+
+	printf ("malloc: %6s %8s %10s %14s %14s %5s\n", "class", "in use",
+			"requests", "requested", "allocated", "frag");
+	for (d = descs; d < descs + desc_cnt; d++) {
+		uint64_t allocated;
+
+		lock_acquire (&d->lock);
+		allocated = d->requests * d->block_size;
+		if (d->requests != 0)
+			printf ("malloc: %6zu %8zu %'10"PRIu64" %'14"PRIu64" %'14"PRIu64" "
+					"%4"PRIu64"%%\n",
+					d->block_size, d->in_use, d->requests, d->requested_bytes,
+					allocated,
+					(allocated - d->requested_bytes) * 100 / allocated);
+		lock_release (&d->lock);
+	}
+
+	lock_acquire (&big.lock);
+	if (big.requests != 0)
+		printf ("malloc: %6s %8zu %'10"PRIu64" %'14"PRIu64" %'14"PRIu64" "
+				"%4"PRIu64"%%\n",
+				"big", big.in_use, big.requests, big.requested_bytes,
+				big.allocated_bytes,
+				(big.allocated_bytes - big.requested_bytes) * 100
+				/ big.allocated_bytes);
+	printf ("malloc: big blocks grown in place %'"PRIu64", shrunk %'"PRIu64
+			", moved %'"PRIu64"\n", big.grown, big.shrunk, big.moved);
+	lock_release (&big.lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
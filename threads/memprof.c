@@ -0,0 +1,288 @@
+#include "threads/memprof.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/spinlock.h"
+#include "threads/vaddr.h"
+
+/* Kernel allocation profiler.
+
+   Two open-addressed hash tables, allocated once at boot, do the
+   bookkeeping.  The site table maps a (call site, allocator) pair
+   to its counters: bytes live now, the most ever live at once,
+   and allocation and free counts.  The live table maps each
+   tracked block to its site and size, so that a free can be
+   charged back to the site that allocated it.  Neither table
+   ever grows, so the profiler never allocates memory itself:
+   once the site table is full, new sites are lumped into one
+   overflow entry, and blocks that do not fit in the live table
+   are counted but not tracked.
+
+   The allocators call in with interrupts in any state, including
+   from the scheduler, so the tables are protected by a spinlock
+   taken with interrupts off.
+
+   The report lists call sites by return address, which
+   `backtrace' resolves to a function and line against kernel.o. */
+
+bool memprof_enabled;
+
+/* Entries in the site and live tables.  Powers of 2. */
+#define SITE_BITS 10
+#define SITE_CNT (1 << SITE_BITS)
+#define LIVE_BITS 15
+#define LIVE_CNT (1 << LIVE_BITS)
+
+/* Highest number of live blocks tracked, to keep probes short. */
+#define LIVE_MAX (LIVE_CNT / 4 * 3)
+
+/* Number of call sites printed by memprof_dump(). */
+#define MEMPROF_REPORT 20
+
+/* Counters for one call site. */
+struct site {
+	const void *site;           /* Caller's return address. */
+	enum memprof_kind kind;     /* Allocator called. */
+	bool used;                  /* In use? */
+	size_t live_bytes;          /* Bytes allocated and not freed. */
+	size_t peak_bytes;          /* Highest LIVE_BYTES seen. */
+	uint64_t allocs;            /* Allocations. */
+	uint64_t frees;             /* Frees. */
+};
+
+/* A tracked block. */
+struct live {
+	const void *ptr;            /* Block address, or null if empty. */
+	uint32_t site;              /* Index in the site table. */
+	uint32_t size;              /* Bytes requested. */
+};
+
+static struct site *sites;
+static struct live *lives;
+static size_t live_cnt;
+static uint64_t untracked;      /* Blocks left out of LIVES. */
+static struct ticket_lock memprof_lock;
+
+/* Returns a hash of X in [0, 2**BITS). */
+static inline size_t
+hash_ptr (const void *x, int bits) {
+	return ((uint64_t) x * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+/* Allocates the profiler's tables, if it is enabled.  Must be
+   called after palloc_init() and before the first allocation to
+   be profiled. */
+void
+memprof_init (void) {
+	size_t site_pages = DIV_ROUND_UP (SITE_CNT * sizeof *sites, PGSIZE);
+	size_t live_pages = DIV_ROUND_UP (LIVE_CNT * sizeof *lives, PGSIZE);
+
+	if (!memprof_enabled)
+		return;
+	ticket_lock_init (&memprof_lock);
+	sites = palloc_get_multiple (PAL_ASSERT | PAL_ZERO | PAL_NOPROF,
+			site_pages);
+	lives = palloc_get_multiple (PAL_ASSERT | PAL_ZERO | PAL_NOPROF,
+			live_pages);
+}
+
+/* Returns the index of the site table entry for SITE and KIND,
+   creating it if necessary.  Entry 0 is the overflow entry. */
+static uint32_t
+site_lookup (const void *site, enum memprof_kind kind) {
+	size_t i = hash_ptr (site, SITE_BITS), probes;
+
+	for (probes = 0; probes < SITE_CNT; probes++, i = (i + 1) % SITE_CNT) {
+		struct site *s = &sites[i];
+
+		if (i == 0)
+			continue;
+		if (!s->used) {
+			s->used = true;
+			s->site = site;
+			s->kind = kind;
+			return i;
+		}
+		if (s->site == site && s->kind == kind)
+			return i;
+	}
+	return 0;
+}
+
+/* Returns the live table slot holding PTR, or the empty slot
+   where it would go. */
+static size_t
+live_slot (const void *ptr) {
+	size_t i = hash_ptr (ptr, LIVE_BITS);
+
+	while (lives[i].ptr != NULL && lives[i].ptr != ptr)
+		i = (i + 1) % LIVE_CNT;
+	return i;
+}
+
+/* Empties live table slot I, moving later entries of the same
+   probe run back so that lookups never hit a gap. */
+static void
+live_remove (size_t i) {
+	size_t j = i;
+
+	for (;;) {
+		size_t home;
+
+		j = (j + 1) % LIVE_CNT;
+		if (lives[j].ptr == NULL)
+			break;
+
+		/* Move entry J into the hole at I unless its home slot
+		   lies cyclically in (I, J]. */
+		home = hash_ptr (lives[j].ptr, LIVE_BITS);
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			lives[i] = lives[j];
+			i = j;
+		}
+	}
+	lives[i].ptr = NULL;
+	live_cnt--;
+}
+
+/* Charges SIZE bytes to site S. */
+static void
+site_charge (struct site *s, size_t size) {
+	s->allocs++;
+	s->live_bytes += size;
+	if (s->live_bytes > s->peak_bytes)
+		s->peak_bytes = s->live_bytes;
+}
+
+/* Records that the allocator of KIND, called from SITE, returned
+   the SIZE-byte block PTR. */
+void
+memprof_alloc (enum memprof_kind kind, const void *ptr, size_t size,
+		const void *site) {
+	enum intr_level old_level;
+	uint32_t idx;
+
+	if (!memprof_enabled || lives == NULL || ptr == NULL)
+		return;
+
+	old_level = ticket_lock_acquire_irqsave (&memprof_lock);
+	idx = site_lookup (site, kind);
+	site_charge (&sites[idx], size);
+	if (live_cnt < LIVE_MAX) {
+		size_t i = live_slot (ptr);
+
+		/* A block freed in pieces, tail first, leaves its record
+		   behind; drop it. */
+		if (lives[i].ptr != NULL)
+			sites[lives[i].site].live_bytes -= lives[i].size;
+		else
+			live_cnt++;
+		lives[i] = (struct live) { .ptr = ptr, .site = idx, .size = size };
+	} else
+		untracked++;
+	ticket_lock_release_irqrestore (&memprof_lock, old_level);
+}
+
+/* Records that the block PTR was resized in place to SIZE bytes.
+   Does nothing if PTR is not tracked. */
+void
+memprof_resize (const void *ptr, size_t size) {
+	enum intr_level old_level;
+	struct live *l;
+
+	if (!memprof_enabled || lives == NULL || ptr == NULL)
+		return;
+
+	old_level = ticket_lock_acquire_irqsave (&memprof_lock);
+	l = &lives[live_slot (ptr)];
+	if (l->ptr != NULL) {
+		struct site *s = &sites[l->site];
+		s->live_bytes += size - l->size;
+		if (s->live_bytes > s->peak_bytes)
+			s->peak_bytes = s->live_bytes;
+		l->size = size;
+	}
+	ticket_lock_release_irqrestore (&memprof_lock, old_level);
+}
+
+/* Records that the block PTR was freed.  Does nothing if PTR is
+   not tracked. */
+void
+memprof_free (const void *ptr) {
+	enum intr_level old_level;
+	size_t i;
+
+	if (!memprof_enabled || lives == NULL || ptr == NULL)
+		return;
+
+	old_level = ticket_lock_acquire_irqsave (&memprof_lock);
+	i = live_slot (ptr);
+	if (lives[i].ptr != NULL) {
+		struct site *s = &sites[lives[i].site];
+		s->live_bytes -= lives[i].size;
+		s->frees++;
+		live_remove (i);
+	}
+	ticket_lock_release_irqrestore (&memprof_lock, old_level);
+}
+
+/* Prints the call sites with the most live memory, and returns
+   how many call sites have been seen, or -1 if the profiler is
+   not enabled. */
+int
+memprof_dump (void) {
+	static const char *kind_name[] = { "malloc", "palloc" };
+	static struct site top[MEMPROF_REPORT];
+	enum intr_level old_level;
+	size_t total = 0, i;
+	int site_cnt = 0, top_cnt = 0, j;
+
+	if (!memprof_enabled || lives == NULL)
+		return -1;
+
+	/* Pick the top sites by live bytes, then by peak, with the
+	   lock held, but print them after releasing it. */
+	old_level = ticket_lock_acquire_irqsave (&memprof_lock);
+	for (i = 0; i < SITE_CNT; i++) {
+		const struct site *s = &sites[i];
+
+		if (!s->used && s->allocs == 0)
+			continue;
+		site_cnt++;
+		total += s->live_bytes;
+		for (j = top_cnt; j > 0; j--) {
+			const struct site *t = &top[j - 1];
+			if (t->live_bytes > s->live_bytes
+					|| (t->live_bytes == s->live_bytes
+						&& t->peak_bytes >= s->peak_bytes))
+				break;
+			if (j < MEMPROF_REPORT)
+				top[j] = *t;
+		}
+		if (j < MEMPROF_REPORT) {
+			top[j] = *s;
+			if (top_cnt < MEMPROF_REPORT)
+				top_cnt++;
+		}
+	}
+	ticket_lock_release_irqrestore (&memprof_lock, old_level);
+
+	printf ("Allocation profile: %'zu bytes live at %d call sites, "
+			"%'"PRIu64" blocks untracked\n", total, site_cnt, untracked);
+	printf ("  %-6s %-18s %14s %14s %12s %12s\n", "alloc", "call site",
+			"live bytes", "peak bytes", "allocs", "frees");
+	for (j = 0; j < top_cnt; j++) {
+		const struct site *s = &top[j];
+		if (s->used)
+			printf ("  %-6s %18p", kind_name[s->kind], s->site);
+		else
+			printf ("  %-6s %-18s", "", "(other)");
+		printf (" %'14zu %'14zu %'12"PRIu64" %'12"PRIu64"\n",
+				s->live_bytes, s->peak_bytes, s->allocs, s->frees);
+	}
+	printf ("The `backtrace' program can resolve the call sites.\n");
+	return site_cnt;
+}
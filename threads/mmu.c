@@ -8,12 +8,48 @@
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Returns true if ENTRY, a PDE or PDPE, maps a large page
+ * itself rather than pointing to a lower level table. */
+static inline bool
+is_large (uint64_t entry) {
+	return (entry & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
+/* Replaces the large page entry *ENTRY, which maps SIZE bytes, by
+ * a pointer to a new table whose entries map the same memory with
+ * the same permissions in pieces of SIZE / 512 bytes.  Returns
+ * false if memory is not available. */
+static bool
+split_large (uint64_t *entry, uint64_t size) {
+	uint64_t *table = palloc_get_page (0);
+	uint64_t sub = size / (PGSIZE / sizeof (uint64_t));
+	uint64_t base = PTE_ADDR (*entry) & ~(size - 1);
+	uint64_t flags = *entry & PTE_FLAGS & ~PTE_PS;
+
+	if (table == NULL)
+		return false;
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++)
+		table[i] = (base + i * sub) | flags | (sub > PGSIZE ? PTE_PS : 0);
+	*entry = vtop (table) | PTE_U | PTE_W | PTE_P;
+
+	/* The old translation may be cached anywhere in the range. */
+	lcr3 (rcr3 ());
+	return true;
+}
+
 static uint64_t *
-pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
+pgdir_walk (uint64_t *pdp, const uint64_t va, int create, uint64_t *size) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
-		if (!((uint64_t) pte & PTE_P)) {
+		if (is_large (pdp[idx])) {
+			if (!create) {
+				*size = LARGE_PGSIZE;
+				return &pdp[idx];
+			}
+			if (!split_large (&pdp[idx], LARGE_PGSIZE))
+				return NULL;
+		} else if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
 				if (new_page)
@@ -23,19 +59,27 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		*size = PGSIZE;
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
 }
 
 static uint64_t *
-pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
+pdpe_walk (uint64_t *pdpe, const uint64_t va, int create, uint64_t *size) {
 	uint64_t *pte = NULL;
 	int idx = PDPE (va);
 	int allocated = 0;
 	if (pdpe) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
-		if (!((uint64_t) pde & PTE_P)) {
+		if (is_large (pdpe[idx])) {
+			if (!create) {
+				*size = HUGE_PGSIZE;
+				return &pdpe[idx];
+			}
+			if (!split_large (&pdpe[idx], HUGE_PGSIZE))
+				return NULL;
+		} else if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
 				if (new_page) {
@@ -46,7 +90,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
+		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create, size);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
@@ -55,14 +99,11 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
-/* Returns the address of the page table entry for virtual
- * address VADDR in page map level 4, pml4.
- * If PML4E does not have a page table for VADDR, behavior depends
- * on CREATE.  If CREATE is true, then a new page table is
- * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
-uint64_t *
-pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+/* Like pml4e_walk(), but also stores the number of bytes mapped
+ * by the returned entry in *SIZE. */
+static uint64_t *
+pml4e_walk_size (uint64_t *pml4e, const uint64_t va, int create,
+		uint64_t *size) {
 	uint64_t *pte = NULL;
 	int idx = PML4 (va);
 	int allocated = 0;
@@ -79,7 +120,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
+		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create, size);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
@@ -88,6 +129,55 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page table entry for virtual
+ * address VADDR in page map level 4, pml4.
+ * If PML4E does not have a page table for VADDR, behavior depends
+ * on CREATE.  If CREATE is true, then a new page table is
+ * created and a pointer into it is returned.  Otherwise, a null
+ * pointer is returned.
+ * If VADDR lies in a large page, then with CREATE false the large
+ * page's PDE or PDPE is returned instead, whose flags mean the
+ * same as a PTE's; with CREATE true the large page is first split
+ * into 4 kB pages. */
+uint64_t *
+pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+	uint64_t size;
+
+	return pml4e_walk_size (pml4e, va, create, &size);
+}
+
+/* Returns the page table entry that points to TABLE_ENTRY's
+ * table, creating an empty table if there is none and CREATE is
+ * true.  Returns a null pointer on failure. */
+static uint64_t *
+next_table (uint64_t *table_entry, int create) {
+	if (!(*table_entry & PTE_P)) {
+		uint64_t *new_page;
+
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		*table_entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return ptov (PTE_ADDR (*table_entry));
+}
+
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, so that the caller can map a large page by
+ * storing an entry with PTE_PS set in it.  Missing tables above it
+ * are created if CREATE is true; otherwise a null pointer is
+ * returned.  Also returns a null pointer if VA lies in a 1 GB
+ * page. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpt, *pd;
+
+	pdpt = next_table (&pml4[PML4 (va)], create);
+	if (pdpt == NULL || is_large (pdpt[PDPE (va)]))
+		return NULL;
+	pd = next_table (&pdpt[PDPE (va)], create);
+	return pd != NULL ? &pd[PDX (va)] : NULL;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +212,13 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (is_large (pdp[i])) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -135,7 +231,12 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
+		if (is_large (pdp[i])) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) i << PDPESHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pde) & PTE_P)
 			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
@@ -143,7 +244,9 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * A large page is passed as its PDE or PDPE and its first
+ * address. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,7 +272,7 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if ((((uint64_t) pte) & PTE_P) && !is_large (pdp[i]))
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -179,7 +282,7 @@ static void
 pdpe_destroy (uint64_t *pdpe) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
-		if (((uint64_t) pde) & PTE_P)
+		if ((((uint64_t) pde) & PTE_P) && !is_large (pdpe[i]))
 			pgdir_destroy ((void *) PTE_ADDR (pde));
 	}
 	palloc_free_page ((void *) pdpe);
@@ -214,10 +317,12 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = pml4e_walk_size (pml4, (uint64_t) uaddr, 0, &size);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
@@ -262,6 +367,25 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	}
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+ * VPAGE in PML4, keeping the other bits, if the page is present.
+ * Unlike clearing the page and setting it again, this never
+ * leaves a moment in which an access to the page faults. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,7 +10,9 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/memprof.h"
+#include "threads/shrinker.h"
+#include "threads/spinlock.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,24 +27,140 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned (relative to the pool base) to its own size, on
+   one free list per order.  Allocating pops the smallest block
+   that is large enough and splits the unused halves back onto
+   the lower free lists; freeing merges a block with its buddy,
+   the other half of the next larger block, for as long as the
+   buddy is free too.  Both take O(PALLOC_MAX_ORDER) steps.  A
+   request that is not a power of two is rounded up and the
+   excess tail is freed straight back.
+
+   A free block's list_elem lives in its own first page, and
+   ORDER_MAP records, for each page, the order of the free block
+   starting there, so the state of a buddy is found in O(1).
+   USED_MAP still marks every allocated page, for checking.
+
+   The pool lock is a spinlock taken with interrupts off, since
+   pages are freed from inside the scheduler, where sleeping is
+   impossible.  Every operation under it is short.
+
+   Single pages, by far the most common request, are served from
+   a per-pool magazine: a small LIFO stack of pages that are
+   allocated as far as the buddy allocator is concerned.  Taking
+   a page from it or returning one needs neither the lock nor
+   the bitmap, only interrupts off, and hands out the most
+   recently freed, cache-warm page first.  An empty magazine is
+   refilled, and a full one drained, MAG_BATCH pages at a time.
+
+   The split between the pools is not fixed.  A pool that runs
+   out borrows a whole chunk of LEND_PAGES pages from the other
+   one, carved out of the lender as an ordinary allocation, and
+   serves requests from it until every page is freed again, when
+   the chunk goes back.  A lender never lets its free pages drop
+   below its reserve floor, so a user process that eats memory
+   cannot starve the kernel, and vice versa.  The chunk's first
+   page holds a struct lease with a bitmap of its used pages.  An
+   explicit user pool limit ("-ul") is a hard cap, so the user
+   pool does not borrow when one is given.
+
+   Only when borrowing fails too are the registered shrinkers
+   asked to give memory back (see shrinker.h), after which the
+   allocation is tried once more.  That is done for the kernel
+   pool only: shrinkers give back kernel memory, which a user
+   request that the lender's reserve already refused cannot use,
+   and the VM reclaims user frames by evicting them. */
+
+/* Largest block order: 2**18 pages, or 1 GB. */
+#define PALLOC_MAX_ORDER 18
+
+/* ORDER_MAP value for a page that does not start a free block. */
+#define ORDER_NONE 0xff
+
+/* Magazine capacity, and how many pages move per refill or
+   drain. */
+#define MAG_SIZE 32
+#define MAG_BATCH 16
+
+/* Pages in a chunk lent between pools: 2**LEND_ORDER, or 1 MB. */
+#define LEND_ORDER 8
+#define LEND_PAGES ((size_t) 1 << LEND_ORDER)
+
+/* Part of each pool's free pages it keeps to itself, rather than
+   lend out: the kernel's reserve is larger, since it cannot page
+   out its memory to get more. */
+#define KERNEL_RESERVE_DIV 4
+#define USER_RESERVE_DIV 8
+
+/* A chunk of LEND_PAGES pages lent by one pool to the other.
+   Lives in the first page of the chunk itself. */
+struct lease {
+	struct list_elem elem;          /* Element in borrower's list. */
+	size_t free_cnt;                /* Pages free for the borrower. */
+	struct bitmap *used;            /* Used pages, this one included. */
+};
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct ticket_lock lock;        /* Mutual exclusion. */
+	struct bitmap *used_map;        /* Bitmap of used pages. */
+	uint8_t *order_map;             /* Free block order, per page. */
+	struct list free_list[PALLOC_MAX_ORDER + 1]; /* Free blocks. */
+	size_t free_blocks[PALLOC_MAX_ORDER + 1];    /* Length of each. */
+	size_t free_pages;              /* Free pages, in total. */
 	uint8_t *base;                  /* Base of pool. */
+
+	/* Single-page magazine.  Only touched with interrupts off. */
+	void *mag[MAG_SIZE];            /* Cached pages, newest last. */
+	size_t mag_cnt;                 /* Number of cached pages. */
+	uint64_t mag_hits;              /* Allocations served from it. */
+	uint64_t mag_misses;            /* Allocations that had to refill. */
+	uint64_t mag_frees;             /* Frees absorbed by it. */
+	uint64_t mag_drains;            /* Batches drained back to the pool. */
+
+	/* Lending.  Protected by lend_lock. */
+	struct lease **leases;          /* Lease per chunk, if lent out. */
+	struct list borrowed;           /* Leases from the other pool. */
+	size_t reserve;                 /* Free pages never lent out. */
+	size_t lent_cnt;                /* Chunks now lent out. */
+	size_t borrowed_cnt;            /* Chunks now borrowed. */
+	uint64_t borrows;               /* Chunks borrowed, in total. */
+	uint64_t returns;               /* Chunks given back, in total. */
+	uint64_t refusals;              /* Borrowing attempts that failed. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Protects the lending state of both pools.  Taken before a
+   pool's own lock. */
+static struct ticket_lock lend_lock = TICKET_LOCK_INITIALIZER;
+
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_release (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t pool_claim (struct pool *, size_t page_cnt);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_claim (struct pool *, size_t page_idx, size_t page_cnt);
+static void *magazine_get (struct pool *);
+static void magazine_put (struct pool *, void *page);
+static void magazine_drain (struct pool *, size_t page_cnt);
+static struct lease *pool_lease (const struct pool *, size_t page_idx);
+static void *get_multiple (enum palloc_flags, size_t page_cnt,
+		const void *caller);
+static void *pool_get (struct pool *, size_t page_cnt);
+static void *pool_borrow (struct pool *, size_t page_cnt);
+static void lease_free (struct pool *, struct lease *, void *pages,
+		size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -223,12 +342,12 @@ split:
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_release (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_release (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -250,6 +369,8 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	kernel_pool.reserve = kernel_pool.free_pages / KERNEL_RESERVE_DIV;
+	user_pool.reserve = user_pool.free_pages / USER_RESERVE_DIV;
 	return ext_mem.end;
 }
 
@@ -261,21 +382,25 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return get_multiple (flags, page_cnt, __builtin_return_address (0));
+}
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+/* Does the work of palloc_get_multiple(), charging the pages to
+   CALLER in the allocation profiler unless PAL_NOPROF is set. */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt, const void *caller) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	pages = pool_get (pool, page_cnt);
+	if (pages == NULL && pool == &kernel_pool && shrink_memory (page_cnt) > 0)
+		pages = pool_get (pool, page_cnt);
 
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
+		if (!(flags & PAL_NOPROF))
+			memprof_alloc (MEMPROF_PALLOC, pages, PGSIZE * page_cnt, caller);
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -293,14 +418,16 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	return get_multiple (flags, 1, __builtin_return_address (0));
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
+	struct lease *lease;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -314,12 +441,68 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 		NOT_REACHED ();
 
 	page_idx = pg_no (pages) - pg_no (pool->base);
+	memprof_free (pages);
 
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	/* A chunk with pages allocated in it cannot stop being lent
+	   out under us, so this is safe to read without the lock. */
+	lease = pool_lease (pool, page_idx);
+	if (lease != NULL) {
+		lease_free (pool, lease, pages, page_cnt);
+		return;
+	}
+
+	if (page_cnt == 1) {
+		magazine_put (pool, pages);
+		return;
+	}
+
+	old_level = ticket_lock_acquire_irqsave (&pool->lock);
+	pool_release (pool, page_idx, page_cnt);
+	ticket_lock_release_irqrestore (&pool->lock, old_level);
+}
+
+/* Tries to grow the block of PAGE_CNT pages starting at PAGES,
+   which must have been obtained from palloc_get_multiple(), to
+   NEW_CNT pages by claiming the pages that directly follow it.
+   Returns true if successful.  On failure, nothing changes. */
+bool
+palloc_grow_multiple (void *pages, size_t page_cnt, size_t new_cnt) {
+	struct pool *pool;
+	size_t page_idx, extra;
+	enum intr_level old_level;
+	bool success = false;
+
+	ASSERT (pg_ofs (pages) == 0);
+	ASSERT (new_cnt >= page_cnt);
+
+	if (page_from_pool (&kernel_pool, pages))
+		pool = &kernel_pool;
+	else if (page_from_pool (&user_pool, pages))
+		pool = &user_pool;
+	else
+		NOT_REACHED ();
+
+	page_idx = pg_no (pages) - pg_no (pool->base) + page_cnt;
+	extra = new_cnt - page_cnt;
+	if (extra == 0)
+		return true;
+
+	old_level = ticket_lock_acquire_irqsave (&pool->lock);
+	if (page_idx + extra <= bitmap_size (pool->used_map)
+			&& bitmap_none (pool->used_map, page_idx, extra)) {
+		buddy_claim (pool, page_idx, extra);
+		bitmap_set_multiple (pool->used_map, page_idx, extra, true);
+		success = true;
+	}
+	ticket_lock_release_irqrestore (&pool->lock, old_level);
+
+	if (success)
+		memprof_resize (pages, PGSIZE * new_cnt);
+
+	return success;
 }
 
 /* Frees the page at PAGE. */
@@ -336,15 +519,53 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
+	size_t lease_bytes = (pgcnt >> LEND_ORDER) * sizeof *p->leases;
+	size_t ls_pages = DIV_ROUND_UP (lease_bytes, PGSIZE) * PGSIZE;
+	int order;
 
-	lock_init(&p->lock);
+	ticket_lock_init (&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->order_map = *bm_base + bm_pages;
+	p->leases = *bm_base + bm_pages + om_pages;
 	p->base = (void *) start;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->order_map, ORDER_NONE, pgcnt);
+	for (order = 0; order <= PALLOC_MAX_ORDER; order++) {
+		list_init (&p->free_list[order]);
+		p->free_blocks[order] = 0;
+	}
+	p->free_pages = 0;
+	p->mag_cnt = 0;
+	p->mag_hits = p->mag_misses = p->mag_frees = p->mag_drains = 0;
+	memset (p->leases, 0, lease_bytes);
+	list_init (&p->borrowed);
+	p->reserve = p->lent_cnt = p->borrowed_cnt = 0;
+	p->borrows = p->returns = p->refusals = 0;
+
+	*bm_base += bm_pages + om_pages + ls_pages;
+}
 
-	*bm_base += bm_pages;
+/* Allocates PAGE_CNT contiguous pages for POOL: from its
+   magazine or its buddy allocator, or failing that, from memory
+   borrowed from the other pool.  Returns a null pointer if none
+   of these has enough. */
+static void *
+pool_get (struct pool *pool, size_t page_cnt) {
+	void *pages = NULL;
+
+	if (page_cnt == 1)
+		pages = magazine_get (pool);
+	else {
+		size_t page_idx = pool_claim (pool, page_cnt);
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
+	if (pages == NULL)
+		pages = pool_borrow (pool, page_cnt);
+	return pages;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -356,3 +577,429 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Marks the PAGE_CNT used pages starting at PAGE_IDX in POOL as
+   free.  The pool's lock must be held, or the pool not yet in
+   use. */
+static void
+pool_release (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_free (pool, page_idx, page_cnt);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL, marks them
+   used, and returns the index of the first, or BITMAP_ERROR if
+   the pool has no large enough run.  Pages idling in the
+   magazine are given back to the pool before giving up. */
+static size_t
+pool_claim (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level;
+	size_t page_idx;
+
+	old_level = ticket_lock_acquire_irqsave (&pool->lock);
+	page_idx = buddy_alloc (pool, page_cnt);
+	if (page_idx == BITMAP_ERROR && pool->mag_cnt > 0) {
+		magazine_drain (pool, pool->mag_cnt);
+		page_idx = buddy_alloc (pool, page_cnt);
+	}
+	if (page_idx != BITMAP_ERROR) {
+		ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	}
+	ticket_lock_release_irqrestore (&pool->lock, old_level);
+
+	return page_idx;
+}
+
+/* Single-page magazine. */
+
+/* Returns a page from POOL's magazine, refilling it from the
+   pool first if it is empty.  Returns a null pointer if the pool
+   is out of pages too. */
+static void *
+magazine_get (struct pool *pool) {
+	enum intr_level old_level;
+	void *page = NULL;
+
+	old_level = intr_disable ();
+	if (pool->mag_cnt > 0)
+		pool->mag_hits++;
+	else {
+		pool->mag_misses++;
+
+		ticket_lock_acquire (&pool->lock);
+		while (pool->mag_cnt < MAG_BATCH) {
+			size_t page_idx = buddy_alloc (pool, 1);
+			if (page_idx == BITMAP_ERROR)
+				break;
+			ASSERT (!bitmap_test (pool->used_map, page_idx));
+			bitmap_mark (pool->used_map, page_idx);
+			pool->mag[pool->mag_cnt++] = pool->base + PGSIZE * page_idx;
+		}
+		ticket_lock_release (&pool->lock);
+	}
+	if (pool->mag_cnt > 0)
+		page = pool->mag[--pool->mag_cnt];
+	intr_set_level (old_level);
+
+	return page;
+}
+
+/* Returns PAGE, which must be allocated from POOL, to POOL's
+   magazine, draining the magazine first if it is full.  Pages in
+   the magazine are still marked used, so a page freed twice is
+   caught by finding it there already, as pool_release() would
+   catch it by finding it free. */
+static void
+magazine_put (struct pool *pool, void *page) {
+	enum intr_level old_level;
+	size_t i UNUSED;
+
+	old_level = intr_disable ();
+	ASSERT (bitmap_test (pool->used_map, pg_no (page) - pg_no (pool->base)));
+#ifndef NDEBUG
+	for (i = 0; i < pool->mag_cnt; i++)
+		ASSERT (pool->mag[i] != page);
+#endif
+	if (pool->mag_cnt == MAG_SIZE) {
+		ticket_lock_acquire (&pool->lock);
+		magazine_drain (pool, MAG_BATCH);
+		ticket_lock_release (&pool->lock);
+	}
+	pool->mag[pool->mag_cnt++] = page;
+	pool->mag_frees++;
+	intr_set_level (old_level);
+}
+
+/* Frees the PAGE_CNT oldest pages in POOL's magazine back to the
+   pool.  The pool's lock must be held. */
+static void
+magazine_drain (struct pool *pool, size_t page_cnt) {
+	size_t i;
+
+	ASSERT (page_cnt <= pool->mag_cnt);
+
+	for (i = 0; i < page_cnt; i++)
+		pool_release (pool, pg_no (pool->mag[i]) - pg_no (pool->base), 1);
+	pool->mag_cnt -= page_cnt;
+	memmove (pool->mag, pool->mag + page_cnt, sizeof *pool->mag * pool->mag_cnt);
+	pool->mag_drains++;
+}
+
+/* Buddy allocator. */
+
+/* Returns the first page of the block at PAGE_IDX in POOL. */
+static void *
+block_page (const struct pool *pool, size_t page_idx) {
+	return pool->base + PGSIZE * page_idx;
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX on POOL's free
+   list for ORDER. */
+static void
+block_insert (struct pool *pool, size_t page_idx, int order) {
+	list_push_front (&pool->free_list[order], block_page (pool, page_idx));
+	pool->order_map[page_idx] = order;
+	pool->free_blocks[order]++;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off POOL's
+   free list for ORDER. */
+static void
+block_remove (struct pool *pool, size_t page_idx, int order) {
+	ASSERT (pool->order_map[page_idx] == order);
+
+	list_remove (block_page (pool, page_idx));
+	pool->order_map[page_idx] = ORDER_NONE;
+	pool->free_blocks[order]--;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, which must be
+   aligned to its size, merging it with its buddy for as long as
+   the buddy is free as a whole. */
+static void
+block_free (struct pool *pool, size_t page_idx, int order) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+
+	while (order < PALLOC_MAX_ORDER) {
+		size_t size = (size_t) 1 << order;
+		size_t buddy = page_idx ^ size;
+
+		if (buddy + size > pool_pages || pool->order_map[buddy] != order)
+			break;
+		block_remove (pool, buddy, order);
+		page_idx &= ~size;
+		order++;
+	}
+	block_insert (pool, page_idx, order);
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+order_for (size_t page_cnt) {
+	int order = 0;
+
+	while (((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is large
+   enough.  The pool's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	int want = order_for (page_cnt);
+	int order;
+	size_t page_idx;
+
+	if (page_cnt == 0 || want > PALLOC_MAX_ORDER)
+		return BITMAP_ERROR;
+
+	for (order = want; order <= PALLOC_MAX_ORDER; order++)
+		if (!list_empty (&pool->free_list[order]))
+			break;
+	if (order > PALLOC_MAX_ORDER)
+		return BITMAP_ERROR;
+
+	page_idx = pg_no (list_front (&pool->free_list[order])) - pg_no (pool->base);
+	block_remove (pool, page_idx, order);
+
+	/* Split off the halves we do not need. */
+	while (order > want) {
+		order--;
+		block_insert (pool, page_idx + ((size_t) 1 << order), order);
+	}
+	pool->free_pages -= (size_t) 1 << want;
+
+	/* Give back the tail of a block larger than asked for. */
+	if (page_cnt < (size_t) 1 << want)
+		buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+	return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL's free
+   lists, as the largest aligned blocks that fit.  The pool's lock
+   must be held. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t end = page_idx + page_cnt;
+
+	while (page_idx < end) {
+		int order = 0;
+
+		while (order < PALLOC_MAX_ORDER
+				&& (page_idx & (((size_t) 2 << order) - 1)) == 0
+				&& page_idx + ((size_t) 2 << order) <= end)
+			order++;
+		block_free (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+	}
+	pool->free_pages += page_cnt;
+}
+
+/* Takes the PAGE_CNT free pages starting at PAGE_IDX off POOL's
+   free lists, splitting the free blocks that hold them.  The
+   pool's lock must be held. */
+static void
+buddy_claim (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t end = page_idx + page_cnt;
+
+	while (page_idx < end) {
+		size_t head = page_idx, block_end, claim_end;
+		int order;
+
+		/* Find the free block that holds PAGE_IDX. */
+		for (order = 0; order <= PALLOC_MAX_ORDER; order++) {
+			head = page_idx & ~(((size_t) 1 << order) - 1);
+			if (pool->order_map[head] == order)
+				break;
+		}
+		ASSERT (order <= PALLOC_MAX_ORDER);
+
+		block_remove (pool, head, order);
+		pool->free_pages -= (size_t) 1 << order;
+
+		/* Free again the parts of it outside the range. */
+		block_end = head + ((size_t) 1 << order);
+		claim_end = block_end < end ? block_end : end;
+		if (head < page_idx)
+			buddy_free (pool, head, page_idx - head);
+		if (claim_end < block_end)
+			buddy_free (pool, claim_end, block_end - claim_end);
+		page_idx = claim_end;
+	}
+}
+
+/* Lending between pools. */
+
+/* Returns the lease for the chunk holding page PAGE_IDX of POOL,
+   or a null pointer if that chunk is not lent out. */
+static struct lease *
+pool_lease (const struct pool *pool, size_t page_idx) {
+	size_t chunk = page_idx >> LEND_ORDER;
+
+	if (chunk >= bitmap_size (pool->used_map) >> LEND_ORDER)
+		return NULL;
+	return pool->leases[chunk];
+}
+
+/* Allocates PAGE_CNT contiguous pages from LEASE, or returns a
+   null pointer if it has no large enough run.  lend_lock must be
+   held. */
+static void *
+lease_alloc (struct lease *lease, size_t page_cnt) {
+	size_t idx = bitmap_scan_and_flip (lease->used, 1, page_cnt, false);
+
+	if (idx == BITMAP_ERROR)
+		return NULL;
+	lease->free_cnt -= page_cnt;
+	return (uint8_t *) lease + PGSIZE * idx;
+}
+
+/* Lends a chunk of LENDER to BORROWER and returns its lease, or
+   returns a null pointer if that would take LENDER below its
+   reserve or it has no free chunk.  lend_lock must be held. */
+static struct lease *
+pool_lend (struct pool *lender, struct pool *borrower) {
+	struct lease *lease;
+	size_t page_idx = BITMAP_ERROR;
+
+	ticket_lock_acquire (&lender->lock);
+	if (lender->free_pages >= lender->reserve + LEND_PAGES)
+		page_idx = buddy_alloc (lender, LEND_PAGES);
+	if (page_idx != BITMAP_ERROR)
+		bitmap_set_multiple (lender->used_map, page_idx, LEND_PAGES, true);
+	ticket_lock_release (&lender->lock);
+
+	if (page_idx == BITMAP_ERROR) {
+		borrower->refusals++;
+		return NULL;
+	}
+
+	lease = block_page (lender, page_idx);
+	lease->free_cnt = LEND_PAGES - 1;
+	lease->used = bitmap_create_in_buf (LEND_PAGES, lease + 1,
+			PGSIZE - sizeof *lease);
+	bitmap_mark (lease->used, 0);
+	list_push_back (&borrower->borrowed, &lease->elem);
+	lender->leases[page_idx >> LEND_ORDER] = lease;
+	lender->lent_cnt++;
+	borrower->borrowed_cnt++;
+	borrower->borrows++;
+	return lease;
+}
+
+/* Allocates PAGE_CNT contiguous pages for POOL, which has none
+   left of its own, from the chunks it has borrowed, borrowing
+   another chunk from the other pool if none has room.  Returns a
+   null pointer if that fails too. */
+static void *
+pool_borrow (struct pool *pool, size_t page_cnt) {
+	struct pool *lender = pool == &kernel_pool ? &user_pool : &kernel_pool;
+	enum intr_level old_level;
+	struct list_elem *e;
+	struct lease *lease;
+	void *pages = NULL;
+
+	if (page_cnt == 0 || page_cnt >= LEND_PAGES)
+		return NULL;
+	if (pool == &user_pool && user_page_limit != SIZE_MAX)
+		return NULL;
+
+	old_level = ticket_lock_acquire_irqsave (&lend_lock);
+	for (e = list_begin (&pool->borrowed);
+			pages == NULL && e != list_end (&pool->borrowed); e = list_next (e))
+		pages = lease_alloc (list_entry (e, struct lease, elem), page_cnt);
+	if (pages == NULL && (lease = pool_lend (lender, pool)) != NULL)
+		pages = lease_alloc (lease, page_cnt);
+	ticket_lock_release_irqrestore (&lend_lock, old_level);
+
+	return pages;
+}
+
+/* Frees the PAGE_CNT pages at PAGES, which lie in the chunk of
+   LENDER described by LEASE.  Gives the chunk back to LENDER
+   once all of its pages are free. */
+static void
+lease_free (struct pool *lender, struct lease *lease, void *pages,
+		size_t page_cnt) {
+	size_t chunk_idx = pg_no (lease) - pg_no (lender->base);
+	struct pool *borrower;
+	enum intr_level old_level;
+
+	old_level = ticket_lock_acquire_irqsave (&lend_lock);
+	ASSERT (bitmap_all (lease->used, pg_no (pages) - pg_no (lease), page_cnt));
+	bitmap_set_multiple (lease->used, pg_no (pages) - pg_no (lease),
+			page_cnt, false);
+	lease->free_cnt += page_cnt;
+
+	if (lease->free_cnt == LEND_PAGES - 1) {
+		borrower = lender == &kernel_pool ? &user_pool : &kernel_pool;
+		list_remove (&lease->elem);
+		lender->leases[chunk_idx >> LEND_ORDER] = NULL;
+		lender->lent_cnt--;
+		borrower->borrowed_cnt--;
+		borrower->returns++;
+
+		ticket_lock_acquire (&lender->lock);
+		pool_release (lender, chunk_idx, LEND_PAGES);
+		ticket_lock_release (&lender->lock);
+	}
+	ticket_lock_release_irqrestore (&lend_lock, old_level);
+}
+
+/* Prints the free-page counts of POOL, named NAME, by order. */
+static void
+pool_print_stats (struct pool *pool, const char *name) {
+	size_t free_blocks[PALLOC_MAX_ORDER + 1];
+	size_t free_pages, mag_cnt, reserve, lent, borrowed;
+	uint64_t hits, misses, frees, drains, borrows, returns, refusals;
+	enum intr_level old_level;
+	int order, top;
+
+	old_level = ticket_lock_acquire_irqsave (&lend_lock);
+	reserve = pool->reserve;
+	lent = pool->lent_cnt;
+	borrowed = pool->borrowed_cnt;
+	borrows = pool->borrows;
+	returns = pool->returns;
+	refusals = pool->refusals;
+	ticket_lock_release_irqrestore (&lend_lock, old_level);
+
+	old_level = ticket_lock_acquire_irqsave (&pool->lock);
+	memcpy (free_blocks, pool->free_blocks, sizeof free_blocks);
+	free_pages = pool->free_pages;
+	mag_cnt = pool->mag_cnt;
+	hits = pool->mag_hits;
+	misses = pool->mag_misses;
+	frees = pool->mag_frees;
+	drains = pool->mag_drains;
+	ticket_lock_release_irqrestore (&pool->lock, old_level);
+
+	printf ("%s pool: %'zu of %'zu pages free, %zu more in magazine\n",
+			name, free_pages, bitmap_size (pool->used_map), mag_cnt);
+	printf ("  magazine: %'"PRIu64" hits, %'"PRIu64" misses (%"PRIu64"%% hit), "
+			"%'"PRIu64" frees, %'"PRIu64" drains\n",
+			hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0,
+			frees, drains);
+	printf ("  lending: %zu chunks lent out, %zu borrowed "
+			"(%'"PRIu64" borrows, %'"PRIu64" returns, %'"PRIu64" refused), "
+			"reserve %'zu pages\n",
+			lent, borrowed, borrows, returns, refusals, reserve);
+
+	for (top = PALLOC_MAX_ORDER; top > 0 && free_blocks[top] == 0; top--)
+		continue;
+	printf ("  free blocks by order:");
+	for (order = 0; order <= top; order++)
+		printf (" %d:%zu", order, free_blocks[order]);
+	printf ("\n");
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	pool_print_stats (&kernel_pool, "Kernel");
+	pool_print_stats (&user_pool, "User");
+}
@@ -0,0 +1,125 @@
+#include "threads/shrinker.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* Shrinker registry.
+
+   shrink_memory() runs with SHRINK_LOCK held, which serializes
+   reclaim and protects the list and the statistics.  Holding it
+   also tells a nested shrink_memory() call, made when a shrinker
+   itself allocates, to give up at once instead of recursing.
+   Shrinkers never wait for locks, so the thread that holds
+   SHRINK_LOCK never blocks, and threads that run out of memory
+   at the same time simply queue for it.
+
+   Reclaim needs to be able to sleep, so it is skipped in
+   interrupt context and with interrupts off. */
+
+/* Pages to try to reclaim at least, even for smaller requests,
+   so that a burst of failing allocations does not call every
+   shrinker once per page. */
+#define SHRINK_BATCH 32
+
+/* Registered shrinkers, in priority order. */
+static struct list shrinkers;
+static struct lock shrink_lock;
+static bool shrinker_ready;
+
+/* Calls to shrink_memory() that ran the shrinkers, and the pages
+   they got back. */
+static uint64_t shrink_calls;
+static uint64_t shrink_reclaimed;
+
+/* Initializes the shrinker registry. */
+void
+shrinker_init (void) {
+	list_init (&shrinkers);
+	lock_init (&shrink_lock);
+	shrinker_ready = true;
+}
+
+/* Orders shrinkers by priority. */
+static bool
+priority_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct shrinker *a = list_entry (a_, struct shrinker, elem);
+	const struct shrinker *b = list_entry (b_, struct shrinker, elem);
+
+	return a->priority < b->priority;
+}
+
+/* Registers S.  Its NAME, PRIORITY, COUNT, SCAN, and AUX must be
+   set; S must stay valid until unregistered. */
+void
+shrinker_register (struct shrinker *s) {
+	ASSERT (shrinker_ready);
+	ASSERT (s != NULL && s->count != NULL && s->scan != NULL);
+
+	s->calls = s->reclaimed = 0;
+	lock_acquire (&shrink_lock);
+	list_insert_ordered (&shrinkers, &s->elem, priority_less, NULL);
+	lock_release (&shrink_lock);
+}
+
+/* Unregisters S. */
+void
+shrinker_unregister (struct shrinker *s) {
+	lock_acquire (&shrink_lock);
+	list_remove (&s->elem);
+	lock_release (&shrink_lock);
+}
+
+/* Asks the registered shrinkers, in priority order, to free at
+   least PAGE_CNT pages.  Returns the number of pages freed, which
+   is 0 if reclaim is impossible in this context. */
+size_t
+shrink_memory (size_t page_cnt) {
+	size_t target = page_cnt > SHRINK_BATCH ? page_cnt : SHRINK_BATCH;
+	size_t freed = 0;
+	struct list_elem *e;
+
+	if (!shrinker_ready || intr_context () || intr_get_level () == INTR_OFF
+			|| lock_held_by_current_thread (&shrink_lock))
+		return 0;
+
+	lock_acquire (&shrink_lock);
+	for (e = list_begin (&shrinkers);
+			freed < target && e != list_end (&shrinkers); e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		size_t avail = s->count (s->aux);
+		size_t got;
+
+		if (avail == 0)
+			continue;
+		got = s->scan (target - freed < avail ? target - freed : avail, s->aux);
+		s->calls++;
+		s->reclaimed += got;
+		freed += got;
+	}
+	shrink_calls++;
+	shrink_reclaimed += freed;
+	lock_release (&shrink_lock);
+
+	return freed;
+}
+
+/* Prints shrinker statistics. */
+void
+shrinker_print_stats (void) {
+	struct list_elem *e;
+
+	lock_acquire (&shrink_lock);
+	printf ("Shrink: %'"PRIu64" calls, %'"PRIu64" pages reclaimed\n",
+			shrink_calls, shrink_reclaimed);
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		printf ("  %s (priority %d): %zu reclaimable, %'"PRIu64" calls, "
+				"%'"PRIu64" pages reclaimed\n", s->name, s->priority,
+				s->count (s->aux), s->calls, s->reclaimed);
+	}
+	lock_release (&shrink_lock);
+}
@@ -0,0 +1,339 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator, after Bonwick's "The Slab Allocator: An
+   Object-Caching Kernel Memory Allocator".
+
+   Each cache carves single pages, called slabs, into objects of
+   exactly its size (rounded up to its alignment).  A slab begins
+   with a struct slab header, followed by a stack of the indexes
+   of its free objects, followed by the objects themselves.
+   Keeping the free stack outside the objects means that a free
+   object is never written to, so an object constructed once by
+   the cache's constructor stays constructed across free and
+   reallocation.
+
+   A cache keeps its slabs on three lists, according to whether
+   they are partially used, full, or empty.  Allocation prefers
+   partial slabs, so that used objects gather in few slabs and
+   the rest drain empty.  Up to SLAB_EMPTY_MAX empty slabs are
+   kept to absorb bursts; slab_cache_shrink() releases them, and
+   so does a shrinker when memory runs out.
+
+   Objects must be no bigger than about half a page, which covers
+   every fixed-size object the kernel has.  Use malloc() for
+   anything bigger. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Empty slabs a cache keeps before returning them to palloc. */
+#define SLAB_EMPTY_MAX 2
+
+/* Slab header, at the start of each slab's page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct slab_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of CACHE's lists. */
+	size_t free_cnt;            /* Number of free objects. */
+	uint16_t free[];            /* Indexes of free objects. */
+};
+
+/* All caches, for statistics. */
+static struct list all_caches;
+static struct lock all_caches_lock;
+
+static size_t slab_shrink_count (void *);
+static size_t slab_shrink_scan (size_t page_cnt, void *);
+
+/* Releases empty slabs under memory pressure. */
+static struct shrinker slab_shrinker = {
+	.name = "slab",
+	.priority = SHRINK_PRI_ALLOC,
+	.count = slab_shrink_count,
+	.scan = slab_shrink_scan,
+};
+
+static struct slab *slab_create (struct slab_cache *);
+static struct slab *obj_to_slab (struct slab_cache *, void *);
+static void *slab_obj (struct slab_cache *, struct slab *, size_t idx);
+
+/* Initializes the slab allocator. */
+void
+slab_init (void) {
+	list_init (&all_caches);
+	lock_init (&all_caches_lock);
+	shrinker_register (&slab_shrinker);
+}
+
+/* Initializes CACHE to hand out objects of SIZE bytes, aligned
+   to ALIGN bytes, which must be a power of 2.  If CTOR is
+   nonnull, it is run on every object when its slab is created.
+   NAME is used for statistics and must stay valid. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name,
+		size_t size, size_t align, slab_ctor_func *ctor) {
+	size_t n;
+
+	ASSERT (cache != NULL);
+	ASSERT (size > 0 && size <= PGSIZE / 2);
+	ASSERT (align > 0 && (align & (align - 1)) == 0);
+
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+
+	cache->name = name;
+	cache->obj_size = size;
+	cache->stride = ROUND_UP (size, align);
+	cache->ctor = ctor;
+
+	/* Fit as many objects as possible after the header and the
+	   free stack. */
+	for (n = (PGSIZE - sizeof (struct slab)) / cache->stride; n > 0; n--) {
+		cache->obj_ofs = ROUND_UP (sizeof (struct slab)
+				+ n * sizeof (uint16_t), align);
+		if (cache->obj_ofs + n * cache->stride <= PGSIZE)
+			break;
+	}
+	ASSERT (n > 0);
+	cache->objs_per_slab = n;
+
+	lock_init (&cache->lock);
+	list_init (&cache->partial);
+	list_init (&cache->full);
+	list_init (&cache->empty);
+	cache->slab_cnt = cache->empty_cnt = cache->in_use = 0;
+	cache->allocs = cache->frees = 0;
+
+	lock_acquire (&all_caches_lock);
+	list_push_back (&all_caches, &cache->elem);
+	lock_release (&all_caches_lock);
+}
+
+/* Obtains and returns a new object from CACHE.  Returns a null
+   pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *cache) {
+	struct slab *s;
+	void *obj;
+
+	ASSERT (cache != NULL);
+
+	lock_acquire (&cache->lock);
+	if (!list_empty (&cache->partial))
+		s = list_entry (list_front (&cache->partial), struct slab, elem);
+	else if (!list_empty (&cache->empty)) {
+		s = list_entry (list_pop_front (&cache->empty), struct slab, elem);
+		cache->empty_cnt--;
+		list_push_front (&cache->partial, &s->elem);
+	} else {
+		s = slab_create (cache);
+		if (s == NULL) {
+			lock_release (&cache->lock);
+			return NULL;
+		}
+		list_push_front (&cache->partial, &s->elem);
+	}
+
+	obj = slab_obj (cache, s, s->free[--s->free_cnt]);
+	if (s->free_cnt == 0) {
+		list_remove (&s->elem);
+		list_push_front (&cache->full, &s->elem);
+	}
+	cache->in_use++;
+	cache->allocs++;
+	lock_release (&cache->lock);
+
+	return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  A null OBJ is ignored. */
+void
+slab_free (struct slab_cache *cache, void *obj) {
+	struct slab *s;
+	struct slab *victim = NULL;
+
+	if (obj == NULL)
+		return;
+
+	s = obj_to_slab (cache, obj);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   it must keep its constructed state. */
+	if (cache->ctor == NULL)
+		memset (obj, 0xcc, cache->obj_size);
+#endif
+
+	lock_acquire (&cache->lock);
+	ASSERT (s->free_cnt < cache->objs_per_slab);
+	s->free[s->free_cnt++] = ((uint8_t *) obj - (uint8_t *) s
+			- cache->obj_ofs) / cache->stride;
+
+	if (s->free_cnt == 1 || s->free_cnt == cache->objs_per_slab) {
+		list_remove (&s->elem);
+		if (s->free_cnt < cache->objs_per_slab)
+			list_push_front (&cache->partial, &s->elem);
+		else if (cache->empty_cnt < SLAB_EMPTY_MAX) {
+			list_push_front (&cache->empty, &s->elem);
+			cache->empty_cnt++;
+		} else {
+			victim = s;
+			cache->slab_cnt--;
+		}
+	}
+	cache->in_use--;
+	cache->frees++;
+	lock_release (&cache->lock);
+
+	if (victim != NULL)
+		palloc_free_page (victim);
+}
+
+/* Returns up to MAX_CNT of CACHE's empty slabs, whose lock must
+   be held, to the page allocator, releasing the lock.  Returns
+   the number of pages freed. */
+static size_t
+cache_release_empty (struct slab_cache *cache, size_t max_cnt) {
+	struct list victims;
+	size_t cnt = 0;
+
+	list_init (&victims);
+	while (!list_empty (&cache->empty) && max_cnt-- > 0) {
+		list_push_back (&victims, list_pop_front (&cache->empty));
+		cache->slab_cnt--;
+		cache->empty_cnt--;
+	}
+	lock_release (&cache->lock);
+
+	while (!list_empty (&victims)) {
+		palloc_free_page (list_entry (list_pop_front (&victims),
+					struct slab, elem));
+		cnt++;
+	}
+	return cnt;
+}
+
+/* Returns all of CACHE's empty slabs to the page allocator.
+   Returns the number of pages freed. */
+size_t
+slab_cache_shrink (struct slab_cache *cache) {
+	lock_acquire (&cache->lock);
+	return cache_release_empty (cache, SIZE_MAX);
+}
+
+/* Shrinker: counts the empty slabs of all caches. */
+static size_t
+slab_shrink_count (void *aux UNUSED) {
+	struct list_elem *e;
+	size_t cnt = 0;
+
+	if (!lock_try_acquire (&all_caches_lock))
+		return 0;
+	for (e = list_begin (&all_caches); e != list_end (&all_caches);
+			e = list_next (e))
+		cnt += list_entry (e, struct slab_cache, elem)->empty_cnt;
+	lock_release (&all_caches_lock);
+	return cnt;
+}
+
+/* Shrinker: frees up to PAGE_CNT empty slabs, skipping caches
+   whose lock is busy, including one that we hold because
+   slab_alloc() is refilling it. */
+static size_t
+slab_shrink_scan (size_t page_cnt, void *aux UNUSED) {
+	struct list_elem *e;
+	size_t cnt = 0;
+
+	if (!lock_try_acquire (&all_caches_lock))
+		return 0;
+	for (e = list_begin (&all_caches);
+			cnt < page_cnt && e != list_end (&all_caches); e = list_next (e)) {
+		struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+		if (!lock_held_by_current_thread (&c->lock)
+				&& lock_try_acquire (&c->lock))
+			cnt += cache_release_empty (c, page_cnt - cnt);
+	}
+	lock_release (&all_caches_lock);
+	return cnt;
+}
+
+/* Prints statistics for every cache. */
+void
+slab_print_stats (void) {
+	struct list_elem *e;
+
+	lock_acquire (&all_caches_lock);
+	for (e = list_begin (&all_caches); e != list_end (&all_caches);
+			e = list_next (e)) {
+		struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+		size_t slab_bytes;
+
+		lock_acquire (&c->lock);
+		slab_bytes = c->slab_cnt * PGSIZE;
+		printf ("Slab %s: %zu-byte objects, %'zu of %'zu in use, "
+				"%zu slabs (%zu empty), %zu%% efficient, "
+				"%'"PRIu64" allocs, %'"PRIu64" frees\n",
+				c->name, c->obj_size, c->in_use,
+				c->slab_cnt * c->objs_per_slab, c->slab_cnt, c->empty_cnt,
+				slab_bytes ? c->in_use * c->obj_size * 100 / slab_bytes : 0,
+				c->allocs, c->frees);
+		lock_release (&c->lock);
+	}
+	lock_release (&all_caches_lock);
+}
+
+/* Allocates and initializes a new empty slab for CACHE, or
+   returns a null pointer if memory is not available.  CACHE's
+   lock must be held. */
+static struct slab *
+slab_create (struct slab_cache *cache) {
+	struct slab *s;
+	size_t i;
+
+	s = palloc_get_page (0);
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = cache;
+	s->free_cnt = cache->objs_per_slab;
+
+	/* Stack the objects so that the first is handed out first. */
+	for (i = 0; i < cache->objs_per_slab; i++) {
+		s->free[i] = cache->objs_per_slab - i - 1;
+		if (cache->ctor != NULL)
+			cache->ctor (slab_obj (cache, s, i));
+	}
+	cache->slab_cnt++;
+	return s;
+}
+
+/* Returns the slab that OBJ, allocated from CACHE, lives in. */
+static struct slab *
+obj_to_slab (struct slab_cache *cache, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == cache);
+	ASSERT (pg_ofs (obj) >= cache->obj_ofs);
+	ASSERT ((pg_ofs (obj) - cache->obj_ofs) % cache->stride == 0);
+
+	return s;
+}
+
+/* Returns the IDX'th object in slab S of CACHE. */
+static void *
+slab_obj (struct slab_cache *cache, struct slab *s, size_t idx) {
+	ASSERT (idx < cache->objs_per_slab);
+
+	return (uint8_t *) s + cache->obj_ofs + idx * cache->stride;
+}
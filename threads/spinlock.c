@@ -0,0 +1,253 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "threads/thread.h"
+
+/* Spinlocks.  See spinlock.h for the rules of use.
+
+   Preemption is disabled for as long as a spinlock is held, so
+   that on a uniprocessor a waiter can only ever spin against an
+   interrupt handler or another CPU, never against a thread that
+   was switched out while holding the lock.  The _irqsave
+   variants disable interrupts first, which on a uniprocessor
+   makes the lock uncontended by construction.  Neither the
+   thread system nor interrupts may be used before thread_init(),
+   so neither may these locks. */
+
+/* Ticket locks. */
+
+/* Initializes LOCK as free. */
+void
+ticket_lock_init (struct ticket_lock *lock) {
+	ASSERT (lock != NULL);
+
+	*lock = (struct ticket_lock) TICKET_LOCK_INITIALIZER;
+}
+
+/* Waits, with preemption already disabled, until LOCK is ours. */
+static void
+ticket_lock_spin (struct ticket_lock *lock) {
+	uint32_t ticket = atomic32_xadd (&lock->next, 1);
+	uint64_t spins = 0;
+
+	while (atomic32_load_acquire (&lock->owner) != ticket) {
+		cpu_relax ();
+		spins++;
+	}
+
+	/* We own the lock, so the counters are ours to update. */
+	lock->stats.acquired++;
+	if (spins != 0) {
+		lock->stats.contended++;
+		lock->stats.spins += spins;
+	}
+}
+
+/* Acquires LOCK, spinning until it is available.  Disables
+   preemption until the matching ticket_lock_release(). */
+void
+ticket_lock_acquire (struct ticket_lock *lock) {
+	ASSERT (lock != NULL);
+
+	preempt_disable ();
+	ticket_lock_spin (lock);
+}
+
+/* Acquires LOCK only if nobody holds or waits for it.  Returns
+   true on success, in which case preemption is disabled. */
+bool
+ticket_lock_try_acquire (struct ticket_lock *lock) {
+	uint32_t owner;
+
+	ASSERT (lock != NULL);
+
+	preempt_disable ();
+	owner = atomic32_load_acquire (&lock->owner);
+	if (atomic32_cmpxchg (&lock->next, owner, owner + 1) == owner) {
+		lock->stats.acquired++;
+		return true;
+	}
+	preempt_enable ();
+	return false;
+}
+
+/* Releases LOCK, which must be held, and re-enables preemption. */
+void
+ticket_lock_release (struct ticket_lock *lock) {
+	ASSERT (ticket_lock_held (lock));
+
+	atomic32_store_release (&lock->owner, lock->owner.value + 1);
+	preempt_enable ();
+}
+
+/* Disables interrupts, acquires LOCK, and returns the previous
+   interrupt level for ticket_lock_release_irqrestore(). */
+enum intr_level
+ticket_lock_acquire_irqsave (struct ticket_lock *lock) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+
+	old_level = intr_disable ();
+	ticket_lock_spin (lock);
+	return old_level;
+}
+
+/* Releases LOCK and restores the interrupt level OLD_LEVEL
+   returned by ticket_lock_acquire_irqsave(). */
+void
+ticket_lock_release_irqrestore (struct ticket_lock *lock,
+		enum intr_level old_level) {
+	ASSERT (ticket_lock_held (lock));
+
+	atomic32_store_release (&lock->owner, lock->owner.value + 1);
+	intr_set_level (old_level);
+}
+
+/* Returns true if somebody holds LOCK.  Only useful in
+   assertions, since the answer may be stale immediately. */
+bool
+ticket_lock_held (const struct ticket_lock *lock) {
+	ASSERT (lock != NULL);
+
+	return lock->next.value != lock->owner.value;
+}
+
+/* MCS locks, after Mellor-Crummey and Scott. */
+
+/* Initializes LOCK as free. */
+void
+mcs_lock_init (struct mcs_lock *lock) {
+	ASSERT (lock != NULL);
+
+	*lock = (struct mcs_lock) MCS_LOCK_INITIALIZER;
+}
+
+/* Queues NODE on LOCK and waits, with preemption already
+   disabled, until it reaches the head of the queue. */
+static void
+mcs_lock_spin (struct mcs_lock *lock, struct mcs_node *node) {
+	struct mcs_node *prev;
+	uint64_t spins = 0;
+
+	node->next = NULL;
+	node->locked = true;
+
+	prev = atomic_ptr_xchg ((void *volatile *) &lock->tail, node);
+	if (prev != NULL) {
+		/* Link behind our predecessor, then wait for it to hand
+		   the lock over by clearing our flag. */
+		prev->next = node;
+		while (node->locked) {
+			cpu_relax ();
+			spins++;
+		}
+	}
+	asm volatile ("" : : : "memory");
+
+	lock->stats.acquired++;
+	if (prev != NULL) {
+		lock->stats.contended++;
+		lock->stats.spins += spins;
+	}
+}
+
+/* Passes LOCK, held through NODE, to the next waiter if any. */
+static void
+mcs_lock_handoff (struct mcs_lock *lock, struct mcs_node *node) {
+	if (node->next == NULL) {
+		/* No known successor.  If we are still the tail, the lock
+		   becomes free; otherwise a successor is between its xchg
+		   and linking itself behind us, so wait for it. */
+		if (atomic_ptr_cmpxchg ((void *volatile *) &lock->tail, node, NULL)
+				== node)
+			return;
+		while (node->next == NULL)
+			cpu_relax ();
+	}
+	asm volatile ("" : : : "memory");
+	node->next->locked = false;
+}
+
+/* Acquires LOCK, spinning until it is available.  NODE is the
+   caller's queue node, which must stay valid and untouched
+   until it is passed to mcs_lock_release().  Disables
+   preemption until then. */
+void
+mcs_lock_acquire (struct mcs_lock *lock, struct mcs_node *node) {
+	ASSERT (lock != NULL);
+	ASSERT (node != NULL);
+
+	preempt_disable ();
+	mcs_lock_spin (lock, node);
+}
+
+/* Acquires LOCK through NODE only if it is free.  Returns true
+   on success, in which case preemption is disabled. */
+bool
+mcs_lock_try_acquire (struct mcs_lock *lock, struct mcs_node *node) {
+	ASSERT (lock != NULL);
+	ASSERT (node != NULL);
+
+	node->next = NULL;
+	node->locked = false;
+
+	preempt_disable ();
+	if (atomic_ptr_cmpxchg ((void *volatile *) &lock->tail, NULL, node)
+			== NULL) {
+		lock->stats.acquired++;
+		return true;
+	}
+	preempt_enable ();
+	return false;
+}
+
+/* Releases LOCK, held through NODE, and re-enables preemption. */
+void
+mcs_lock_release (struct mcs_lock *lock, struct mcs_node *node) {
+	ASSERT (lock != NULL);
+	ASSERT (node != NULL);
+	ASSERT (lock->tail != NULL);
+
+	mcs_lock_handoff (lock, node);
+	preempt_enable ();
+}
+
+/* Disables interrupts, acquires LOCK through NODE, and returns
+   the previous interrupt level. */
+enum intr_level
+mcs_lock_acquire_irqsave (struct mcs_lock *lock, struct mcs_node *node) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+	ASSERT (node != NULL);
+
+	old_level = intr_disable ();
+	mcs_lock_spin (lock, node);
+	return old_level;
+}
+
+/* Releases LOCK, held through NODE, and restores the interrupt
+   level OLD_LEVEL returned by mcs_lock_acquire_irqsave(). */
+void
+mcs_lock_release_irqrestore (struct mcs_lock *lock, struct mcs_node *node,
+		enum intr_level old_level) {
+	ASSERT (lock != NULL);
+	ASSERT (node != NULL);
+	ASSERT (lock->tail != NULL);
+
+	mcs_lock_handoff (lock, node);
+	intr_set_level (old_level);
+}
+
+/* Statistics. */
+
+/* Prints the contention counters S of the spinlock named NAME. */
+void
+spin_stats_print (const char *name, const struct spin_stats *s) {
+	printf ("Spinlock %s: %'"PRIu64" acquired, %'"PRIu64" contended, "
+			"%'"PRIu64" spins\n",
+			name, s->acquired, s->contended, s->spins);
+}
@@ -37,6 +37,15 @@
 bool cmp_sem_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 bool d_elem_cmp_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 
+/* Semaphore count layout.  See struct semaphore. */
+#define SEMA_VALUE_MASK 0xffffffffULL /* Low half: the value. */
+#define SEMA_SLEEPER (1ULL << 32)     /* One sleeping thread. */
+
+static bool sema_fast_down(struct semaphore *sema);
+static void sema_slow_down(struct semaphore *sema);
+static bool sema_fast_up(struct semaphore *sema);
+static void sema_wake(struct semaphore *sema);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -50,13 +59,90 @@ void sema_init(struct semaphore *sema, unsigned value)
 {
 	ASSERT(sema != NULL);
 
-	sema->value = value;
+	sema->count = (struct atomic64)ATOMIC_INIT(value);
 	list_init(&sema->waiters);
 }
 
+/* Decrements SEMA's value if it is positive, with a single
+   compare-and-exchange when nobody races with us.  Returns true
+   if the value was decremented. */
+static bool
+sema_fast_down(struct semaphore *sema)
+{
+	uint64_t count = atomic64_load_acquire(&sema->count);
+
+	while ((count & SEMA_VALUE_MASK) != 0)
+	{
+		uint64_t prev = atomic64_cmpxchg(&sema->count, count, count - 1);
+		if (prev == count)
+			return true;
+		count = prev;
+	}
+	return false;
+}
+
+/* Sleeps on SEMA until its value can be decremented.  Registers
+   as a sleeper in the same atomic step that observes a zero
+   value, so that a concurrent sema_up() either leaves a value
+   for us to take or sees us and takes the slow path to wake us. */
+static void
+sema_slow_down(struct semaphore *sema)
+{
+	enum intr_level old_level = intr_disable();
+
+	for (;;)
+	{
+		uint64_t count = atomic64_load_acquire(&sema->count);
+
+		if ((count & SEMA_VALUE_MASK) != 0)
+		{
+			if (atomic64_cmpxchg(&sema->count, count, count - 1) == count)
+				break;
+		}
+		else if (atomic64_cmpxchg(&sema->count, count, count + SEMA_SLEEPER) == count)
+		{
+			/* Priority Scheduling-Synchronization */
+			list_insert_ordered(&sema->waiters, &thread_current()->elem, cmp_priority, NULL);
+			thread_block();
+		}
+	}
+	intr_set_level(old_level);
+}
+
+/* Increments SEMA's value with a single atomic add.  Returns
+   true if nobody was asleep on SEMA, in which case there is
+   nothing more to do. */
+static bool
+sema_fast_up(struct semaphore *sema)
+{
+	return atomic64_xadd(&sema->count, 1) < SEMA_SLEEPER;
+}
+
+/* Wakes the highest-priority sleeper on SEMA, if any, and
+   yields to it if it outranks us.  The value must already have
+   been incremented. */
+static void
+sema_wake(struct semaphore *sema)
+{
+	enum intr_level old_level = intr_disable();
+
+	if (!list_empty(&sema->waiters))
+	{
+		list_sort(&sema->waiters, cmp_priority, NULL);
+		atomic64_xadd(&sema->count, -SEMA_SLEEPER);
+		thread_unblock(list_entry(list_pop_front(&sema->waiters),
+								  struct thread, elem));
+	}
+	test_max_priority();
+	intr_set_level(old_level);
+}
+
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
    to become positive and then atomically decrements it.
 
+   An uncontended down is a single compare-and-exchange; only if
+   the value is zero are interrupts disabled to sleep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but if it sleeps then the next scheduled
@@ -64,21 +150,11 @@ void sema_init(struct semaphore *sema, unsigned value)
    sema_down function. */
 void sema_down(struct semaphore *sema)
 {
-	enum intr_level old_level;
-
 	ASSERT(sema != NULL);
 	ASSERT(!intr_context());
 
-	old_level = intr_disable();
-	while (sema->value == 0)
-	{
-		/* Priority Scheduling-Synchronization */
-		// list_push_back (&sema->waiters, &thread_current ()->elem);
-		list_insert_ordered(&sema->waiters, &thread_current()->elem, cmp_priority, NULL);
-		thread_block();
-	}
-	sema->value--;
-	intr_set_level(old_level);
+	if (!sema_fast_down(sema))
+		sema_slow_down(sema);
 }
 
 /* Down or "P" operation on a semaphore, but only if the
@@ -88,44 +164,25 @@ void sema_down(struct semaphore *sema)
    This function may be called from an interrupt handler. */
 bool sema_try_down(struct semaphore *sema)
 {
-	enum intr_level old_level;
-	bool success;
-
 	ASSERT(sema != NULL);
 
-	old_level = intr_disable();
-	if (sema->value > 0)
-	{
-		sema->value--;
-		success = true;
-	}
-	else
-		success = false;
-	intr_set_level(old_level);
-
-	return success;
+	return sema_fast_down(sema);
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
    and wakes up one thread of those waiting for SEMA, if any.
 
+   When nobody sleeps on SEMA this is a single atomic add: no
+   thread can be unblocked, so there is no reason to consult the
+   scheduler either.
+
    This function may be called from an interrupt handler. */
 void sema_up(struct semaphore *sema)
 {
-	enum intr_level old_level;
 	ASSERT(sema != NULL);
-	old_level = intr_disable();
-
-	if (!list_empty(&sema->waiters))
-	{
-		list_sort(&sema->waiters, cmp_priority, NULL);
-		thread_unblock(list_entry(list_pop_front(&sema->waiters),
-								  struct thread, elem));
-	}
 
-	sema->value++;
-	test_max_priority();
-	intr_set_level(old_level);
+	if (!sema_fast_up(sema))
+		sema_wake(sema);
 }
 
 static void sema_test_helper(void *sema_);
@@ -233,26 +290,40 @@ bool d_elem_cmp_priority(const struct list_elem *a, const struct list_elem *b, v
    necessary.  The lock must not already be held by the current
    thread.
 
+   A free lock is taken with a single compare-and-exchange on its
+   semaphore.  Only a contended acquire disables interrupts to
+   donate priority and sleep.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void lock_acquire(struct lock *lock)
 {
+	enum intr_level old_level;
+	bool acquired;
 
 	ASSERT(lock != NULL);
 	ASSERT(!intr_context());
 	ASSERT(!lock_held_by_current_thread(lock));
 
-	if (thread_mlfqs)
-	{
-		sema_down(&lock->semaphore);
+	/* Keep the scheduler away until HOLDER is set, so that a
+	   contender never finds the lock taken but ownerless. */
+	preempt_disable();
+	acquired = sema_fast_down(&lock->semaphore);
+	if (acquired)
 		lock->holder = thread_current();
+	preempt_enable();
+	if (acquired)
 		return;
-	}
 
-	/* Priority Donation */
-	if (lock->holder != NULL)
+	/* Priority Donation
+	   Donating and going to sleep on the semaphore happen with
+	   interrupts off, so lock_release() either sees us among the
+	   sleepers, and withdraws our donation, or has already made
+	   the lock available to us. */
+	old_level = intr_disable();
+	if (!thread_mlfqs && lock->holder != NULL)
 	{
 		thread_current()->wait_on_lock = lock;
 		list_insert_ordered(&lock->holder->donations, &thread_current()->d_elem, d_elem_cmp_priority, NULL);
@@ -262,6 +333,7 @@ void lock_acquire(struct lock *lock)
 	sema_down(&lock->semaphore);
 	lock->holder = thread_current();
 	thread_current()->wait_on_lock = NULL;
+	intr_set_level(old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -277,9 +349,11 @@ bool lock_try_acquire(struct lock *lock)
 	ASSERT(lock != NULL);
 	ASSERT(!lock_held_by_current_thread(lock));
 
+	preempt_disable();
 	success = sema_try_down(&lock->semaphore);
 	if (success)
 		lock->holder = thread_current();
+	preempt_enable();
 	return success;
 }
 
@@ -336,24 +410,33 @@ void remove_with_lock(struct lock *lock)
 /* Releases LOCK, which must be owned by the current thread.
    This is lock_release function.
 
+   Donations are only ever made by threads asleep on the lock,
+   so when nobody sleeps on it the release is a single atomic
+   add.  Otherwise the donations for LOCK are withdrawn and the
+   highest-priority sleeper woken.
+
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
    handler. */
 void lock_release(struct lock *lock)
 {
+	enum intr_level old_level;
+
 	ASSERT(lock != NULL);
 	ASSERT(lock_held_by_current_thread(lock));
 
-	if (thread_mlfqs)
-	{
-		lock->holder = NULL;
-		sema_up(&lock->semaphore);
+	lock->holder = NULL;
+	if (sema_fast_up(&lock->semaphore))
 		return;
+
+	old_level = intr_disable();
+	if (!thread_mlfqs)
+	{
+		remove_with_lock(lock);
+		refresh_priority();
 	}
-	remove_with_lock(lock);
-	refresh_priority();
-	lock->holder = NULL;
-	sema_up(&lock->semaphore);
+	sema_wake(&lock->semaphore);
+	intr_set_level(old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -491,3 +574,48 @@ void cond_broadcast(struct condition *cond, struct lock *lock)
 	while (!list_empty(&cond->waiters))
 		cond_signal(cond, lock);
 }
+
+/* Initializes wait queue Q as empty. */
+void waitq_init(struct waitq *q)
+{
+	ASSERT(q != NULL);
+
+	list_init(&q->entries);
+}
+
+/* Adds the current thread to Q through ENTRY, which must stay
+   valid until it is passed to waitq_remove().  The thread does
+   not sleep until it calls thread_sleep_event(). */
+void waitq_add(struct waitq *q, struct waitq_entry *entry)
+{
+	ASSERT(q != NULL);
+	ASSERT(entry != NULL);
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	entry->thread = thread_current();
+	list_push_back(&q->entries, &entry->elem);
+}
+
+/* Removes ENTRY from the wait queue it was added to. */
+void waitq_remove(struct waitq_entry *entry)
+{
+	ASSERT(entry != NULL);
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	list_remove(&entry->elem);
+}
+
+/* Wakes every thread on Q that is asleep in
+   thread_sleep_event().  The threads stay on Q until they
+   remove themselves.  May be called from an interrupt
+   handler. */
+void waitq_wake_all(struct waitq *q)
+{
+	struct list_elem *e;
+
+	ASSERT(q != NULL);
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (e = list_begin(&q->entries); e != list_end(&q->entries); e = list_next(e))
+		thread_wake_event(list_entry(e, struct waitq_entry, elem)->thread);
+}
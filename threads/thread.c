@@ -413,17 +413,49 @@ void test_max_priority(void)
 		return;
 	}
 
-	// enum intr_level oldlevel;
-	// oldlevel = intr_disable();
-	// 인터럽트가 발생해서 현재 달리고 있는 쓰레드를 저장한 변수와 실제 달리고 있는 쓰레드가 다르면 안된다.
-
 	int curr_priority = thread_current()->priority;
 	struct thread *t = list_entry(list_begin(&ready_list), struct thread, elem);
 	if (t->priority > curr_priority)
 	{
+		struct thread *curr = thread_current();
+
+		/* An interrupt handler cannot yield directly, and a thread
+		   inside preempt_disable() must not be switched out until it
+		   calls preempt_enable(). */
+		if (intr_context())
+			intr_yield_on_return();
+		else if (curr->preempt_count > 0)
+			curr->preempt_pending = true;
+		else
+			thread_yield();
+	}
+}
+
+/* Preemption control
+Keeps the running thread from being switched out involuntarily,
+without turning interrupts off.  Interrupt handlers still run,
+but a reschedule they request is deferred until the matching
+preempt_enable().  Calls nest.  The thread may still block or
+yield on its own. */
+void preempt_disable(void)
+{
+	thread_current()->preempt_count++;
+	barrier();
+}
+
+/* Undoes one preempt_disable().  When the outermost call is
+undone, performs any preemption that was deferred meanwhile. */
+void preempt_enable(void)
+{
+	struct thread *curr = thread_current();
+
+	barrier();
+	ASSERT(curr->preempt_count > 0);
+	if (--curr->preempt_count == 0 && curr->preempt_pending && !intr_context() && intr_get_level() == INTR_ON)
+	{
+		curr->preempt_pending = false;
 		thread_yield();
 	}
-	// intr_set_level(oldlevel);
 }
 
 /* Transitions a blocked thread T to the ready-to-run state.
@@ -560,6 +592,7 @@ void thread_wakeup(int64_t global_tick)
 		if (global_tick >= curr_t->wakeup_tick)
 		{
 			curr_p = list_remove(curr_p);
+			curr_t->event_wait = false;
 			thread_unblock(curr_t);
 		}
 		else
@@ -570,6 +603,48 @@ void thread_wakeup(int64_t global_tick)
 	intr_set_level(old_level);
 }
 
+/* Blocks the current thread until thread_wake_event() is called
+   on it or, if TICKS is nonnegative, until the timer reaches
+   TICKS, whichever comes first.  Either way the caller must
+   recheck the condition it was waiting for.
+
+   Interrupts must be off, so that the caller can test its
+   condition and go to sleep without missing a wakeup. */
+void thread_sleep_event(int64_t ticks)
+{
+	struct thread *curr = thread_current();
+
+	ASSERT(!intr_context());
+	ASSERT(intr_get_level() == INTR_OFF);
+	ASSERT(curr != idle_thread);
+
+	curr->event_wait = true;
+	curr->event_timed = ticks >= 0;
+	if (curr->event_timed)
+	{
+		curr->wakeup_tick = ticks;
+		list_push_back(&sleep_list, &curr->elem);
+	}
+	thread_block();
+}
+
+/* Wakes T if it is blocked in thread_sleep_event(), and does
+   nothing otherwise.  May be called from an interrupt handler.
+   Interrupts must be off. */
+void thread_wake_event(struct thread *t)
+{
+	ASSERT(is_thread(t));
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	if (!t->event_wait)
+		return;
+
+	t->event_wait = false;
+	if (t->event_timed)
+		list_remove(&t->elem);
+	thread_unblock(t);
+}
+
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority)
 {
@@ -579,12 +654,17 @@ void thread_set_priority(int new_priority)
 	{
 		return;
 	}
+
+	/* The donation list is also updated by lock_acquire() in other
+	   threads, so no one may run while we recompute. */
+	preempt_disable();
 	thread_current()->origin_priority = new_priority;
 	/* Priority Schedule
 	Check wheter priority of newly updated thread is greater than current running thread
 	*/
 	refresh_priority();
 	test_max_priority();
+	preempt_enable();
 }
 
 /* Returns the current thread's priority. */
@@ -596,39 +676,39 @@ int thread_get_priority(void)
 /* Sets the current thread's nice value to NICE. */
 void thread_set_nice(int nice UNUSED)
 {
-	enum intr_level oldlevel = intr_disable();
+	preempt_disable();
 	struct thread *curr = thread_current();
 	curr->nice = nice;
 	mlfqs_prioirty(curr);
 	test_max_priority();
-	intr_set_level(oldlevel);
+	preempt_enable();
 }
 
 /* Returns the current thread's nice value. */
 int thread_get_nice(void)
 {
-	enum intr_level oldlevel = intr_disable();
+	preempt_disable();
 	struct thread *curr = thread_current();
 	int nice = curr->nice;
-	intr_set_level(oldlevel);
+	preempt_enable();
 	return nice;
 }
 
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void)
 {
-	enum intr_level oldlevel = intr_disable();
+	preempt_disable();
 	int r_load_avg = fp_to_int_round(mult_mixed(load_avg, 100));
-	intr_set_level(oldlevel);
+	preempt_enable();
 	return r_load_avg;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void)
 {
-	enum intr_level oldlevel = intr_disable();
+	preempt_disable();
 	int recent_cpu = fp_to_int_round(mult_mixed(thread_current()->recent_cpu, 100));
-	intr_set_level(oldlevel);
+	preempt_enable();
 	return recent_cpu;
 }
 
@@ -714,6 +794,11 @@ init_thread(struct thread *t, const char *name, int priority)
 	sema_init(&t->sema_wait, 0);
 	sema_init(&t->sema_exit, 0);
 	sema_init(&t->sema_fork, 0);
+
+#ifdef VM
+	/* Virtual Memory */
+	supplemental_page_table_init(&t->spt);
+#endif
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -842,6 +927,8 @@ do_schedule(int status)
 			list_entry(list_pop_front(&destruction_req), struct thread, elem);
 		palloc_free_page(victim);
 	}
+	/* Any deferred preemption is satisfied by this switch. */
+	thread_current()->preempt_pending = false;
 	thread_current()->status = status;
 	schedule();
 }
@@ -142,8 +142,6 @@ page_fault(struct intr_frame *f)
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
 
-	/* Userprogram */
-	exit(-1);
 #ifdef VM
 	/* For project 3 and later. */
 	if (vm_try_handle_fault(f, fault_addr, user, write, not_present))
@@ -153,6 +151,9 @@ page_fault(struct intr_frame *f)
 	/* Count page faults. */
 	page_fault_cnt++;
 
+	/* Userprogram */
+	exit(-1);
+
 	/* If the fault is true fault, show info and exit. */
 	printf("Page fault at %p: %s error %s page in %s context.\n",
 		   fault_addr,
@@ -13,6 +13,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -872,12 +873,27 @@ install_page(void *upage, void *kpage, bool writable)
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads PAGE from the struct file_segment AUX on its first fault,
+ * and frees AUX. */
 static bool
 lazy_load_segment(struct page *page, void *aux)
 {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct file_segment *seg = aux;
+	uint8_t *kva = page->frame->kva;
+	bool held = lock_held_by_current_thread(&filesys_lock);
+	bool success;
+
+	/* A system call may fault on a user buffer while holding the
+	 * file system lock. */
+	if (!held)
+		lock_acquire(&filesys_lock);
+	success = file_read_at(seg->file, kva, seg->read_bytes, seg->ofs) == (int)seg->read_bytes;
+	if (!held)
+		lock_release(&filesys_lock);
+
+	memset(kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+	file_segment_free(seg);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -910,15 +926,39 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage,
-											writable, lazy_load_segment, aux))
-			return false;
+		if (page_read_bytes == 0)
+		{
+			/* Nothing to read: an anonymous page starts zeroed. */
+			if (!vm_alloc_page(VM_ANON, upage, writable))
+				return false;
+		}
+		else
+		{
+			struct file_segment *seg = malloc(sizeof *seg);
+			if (seg == NULL)
+				return false;
+			seg->file = file_reopen(file);
+			seg->ofs = ofs;
+			seg->read_bytes = page_read_bytes;
+			if (seg->file == NULL)
+			{
+				free(seg);
+				return false;
+			}
+			/* Read-only pages stay backed by the file, so that every
+			 * process running the executable can share them through
+			 * the text cache.  Writable ones go to swap once written. */
+			enum vm_type type = writable ? VM_ANON : VM_FILE | VM_TEXT;
+			vm_initializer *init = writable ? lazy_load_segment : file_lazy_load;
+
+			if (!vm_alloc_page_with_initializer(type, upage, writable, init, seg))
+				return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
 		upage += PGSIZE;
 	}
 	return true;
@@ -931,11 +971,11 @@ setup_stack(struct intr_frame *if_)
 	bool success = false;
 	void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true) && vm_claim_page(stack_bottom))
+	{
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
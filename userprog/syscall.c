@@ -14,6 +14,13 @@
 #include "filesys/file.h"
 #include "devices/input.h"
 #include "threads/palloc.h"
+#include "threads/memprof.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
+#include "devices/timer.h"
+#include <round.h>
+#include <string.h>
 
 void syscall_entry(void);
 void syscall_handler(struct intr_frame *);
@@ -34,6 +41,11 @@ int write(int fd, const void *buffer, unsigned length);
 void seek(int fd, unsigned position);
 unsigned tell(int fd);
 void close(int fd);
+int poll(struct pollfd *fds, unsigned nfds, int timeout);
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap(void *addr);
+#endif
 
 /* System call.
  *
@@ -68,6 +80,9 @@ void syscall_init(void)
 void syscall_handler(struct intr_frame *f UNUSED)
 {
 	// printf("syscall_call : %d \n",f->R.rax);
+#ifdef VM
+	thread_current()->user_rsp = (void *)f->rsp;
+#endif
 	switch (f->R.rax)
 	{
 	case SYS_HALT:
@@ -125,6 +140,24 @@ void syscall_handler(struct intr_frame *f UNUSED)
 	case SYS_CLOSE:
 		close(f->R.rdi);
 		break;
+
+	case SYS_POLL:
+		f->R.rax = poll((struct pollfd *)f->R.rdi, f->R.rsi, f->R.rdx);
+		break;
+
+#ifdef VM
+	case SYS_MMAP:
+		f->R.rax = (uint64_t)mmap((void *)f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+		break;
+
+	case SYS_MUNMAP:
+		munmap((void *)f->R.rdi);
+		break;
+#endif
+
+	case SYS_MEMPROF:
+		f->R.rax = memprof_dump();
+		break;
 	}
 }
 
@@ -132,10 +165,19 @@ void syscall_handler(struct intr_frame *f UNUSED)
 int check_address(void *addr)
 {
 	struct thread *curr = thread_current();
+#ifdef VM
+	/* The page may not be loaded yet.  The page fault handler
+	 * loads it, or kills the process if ADDR is not valid. */
+	if (addr == NULL || is_kernel_vaddr(addr))
+	{
+		exit(-1);
+	}
+#else
 	if (is_kernel_vaddr(addr) || pml4_get_page(curr->pml4, addr) == NULL)
 	{
 		exit(-1);
 	}
+#endif
 }
 
 /* System Call Begin */
@@ -148,6 +190,12 @@ void exit(int status)
 {
 	// printf("exit begin \n");
 	struct thread *curr = thread_current();
+
+	/* A bad user pointer may kill us in the middle of a file
+	 * system call. */
+	if (lock_held_by_current_thread(&filesys_lock))
+		lock_release(&filesys_lock);
+
 	curr->return_status = status;
 	printf("%s: exit(%d)\n", curr->name, status);
 
@@ -373,3 +421,131 @@ int sys_fork(const char *thread_name, struct intr_frame *f)
 {
 	return process_fork(thread_name, f);
 }
+
+#ifdef VM
+/* Memory-mapped files */
+
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+	struct file *file;
+
+	if (fd < 2 || fd >= thread_current()->next_fd)
+		return NULL;
+	file = process_get_file(fd);
+	if (file == NULL)
+		return NULL;
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+void munmap(void *addr)
+{
+	do_munmap(addr);
+}
+#endif
+
+/* I/O multiplexing */
+
+/* Most descriptors poll() accepts at once: one per fdt slot. */
+#define POLL_MAX_FDS 64
+
+/* Most distinct wait queues one poll() can sleep on. */
+#define POLL_MAX_QUEUES 4
+
+/* Returns which of EVENTS are ready on FD, or POLLNVAL if FD is
+   not open.  Stores in *Q the wait queue that is woken when FD
+   becomes ready, or a null pointer if FD never blocks.
+   Interrupts must be off. */
+static short poll_fd(int fd, short events, struct waitq **q)
+{
+	struct thread *curr = thread_current();
+
+	*q = NULL;
+	if (fd < 0 || fd >= POLL_MAX_FDS)
+		return POLLNVAL;
+
+	if (fd == 0)
+	{
+		*q = input_waitq();
+		return input_empty() ? 0 : events & POLLIN;
+	}
+	if (curr->fdt[fd] == NULL)
+		return POLLNVAL;
+	if (fd == 1)
+		return events & POLLOUT;
+
+	/* Regular files never block. */
+	return events & (POLLIN | POLLOUT);
+}
+
+/* Waits until one of the NFDS descriptors in FDS is ready for
+   the events it asks for, or TIMEOUT milliseconds pass.  A
+   negative TIMEOUT waits forever and zero does not wait at all.
+   Fills in each revents and returns the number of descriptors
+   with nonzero revents, or -1 on error.
+
+   The thread sleeps on the wait queue of every object that may
+   block, so it is woken by whichever becomes ready first, or by
+   the timer at the deadline. */
+int poll(struct pollfd *fds, unsigned nfds, int timeout)
+{
+	struct pollfd kfds[POLL_MAX_FDS];
+	struct waitq *queues[POLL_MAX_QUEUES];
+	struct waitq_entry entries[POLL_MAX_QUEUES];
+	size_t n_entries = 0;
+	enum intr_level old_level;
+	int64_t deadline;
+	unsigned i;
+	size_t j;
+	int ready;
+
+	if (nfds > POLL_MAX_FDS)
+		return -1;
+	if (nfds > 0)
+	{
+		check_address(fds);
+		check_address((char *)(fds + nfds) - 1);
+		memcpy(kfds, fds, nfds * sizeof *kfds);
+	}
+
+	deadline = -1;
+	if (timeout >= 0)
+		deadline = timer_ticks() + DIV_ROUND_UP((int64_t)timeout * TIMER_FREQ, 1000);
+
+	old_level = intr_disable();
+	for (;;)
+	{
+		ready = 0;
+		for (i = 0; i < nfds; i++)
+		{
+			struct waitq *q;
+
+			kfds[i].revents = poll_fd(kfds[i].fd, kfds[i].events, &q);
+			if (kfds[i].revents != 0)
+				ready++;
+
+			/* Join Q once, however many descriptors share it. */
+			if (q != NULL)
+			{
+				for (j = 0; j < n_entries; j++)
+					if (queues[j] == q)
+						break;
+				if (j == n_entries)
+				{
+					ASSERT(n_entries < POLL_MAX_QUEUES);
+					queues[n_entries] = q;
+					waitq_add(q, &entries[n_entries++]);
+				}
+			}
+		}
+		if (ready > 0 || timeout == 0 || (deadline >= 0 && timer_ticks() >= deadline))
+			break;
+		thread_sleep_event(deadline);
+	}
+	for (j = 0; j < n_entries; j++)
+		waitq_remove(&entries[j]);
+	intr_set_level(old_level);
+
+	if (nfds > 0)
+		memcpy(fds, kfds, nfds * sizeof *kfds);
+	return ready;
+}
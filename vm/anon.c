@@ -1,7 +1,66 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <inttypes.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/shrinker.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Swap space.
+ *
+ * An evicted anonymous page goes into a swap entry.  Swap has two
+ * tiers.  An entry first keeps the page LZ-compressed in kernel
+ * memory, in the compressed cache, and goes back into a frame
+ * from there without any disk I/O.  The cache holds at most
+ * ZCACHE_MAX bytes; past that, the entries that have been in it
+ * longest are written to the swap disk, hd1:1, to make room.
+ * Pages that do not compress to ZCACHE_MAX_SIZE bytes skip the
+ * cache and go straight to disk.  The cache also gives its memory
+ * back, the same way, when the kernel pool runs out.
+ *
+ * The swap disk is divided into slots of SLOT_SECTORS sectors, one
+ * page each.  Slots are handed out next-fit, so the pages that one
+ * eviction writes out together land in consecutive slots and go to
+ * the disk as one sequential burst.
+ *
+ * An entry may be shared: when a process forks while one of its
+ * pages is swapped out, the child refers to the same entry instead
+ * of reading it back in, and evicting a frame shared copy-on-write
+ * stores it once for all of its pages.  Entries are therefore
+ * reference counted, and freed, along with their slot or memory,
+ * when the last page that refers to them is swapped in or
+ * destroyed. */
+
+/* Sectors per swap slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Largest compressed page worth keeping in memory. */
+#define ZCACHE_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* Most memory the compressed cache may hold, in bytes. */
+#define ZCACHE_MAX (ram_pages * PGSIZE / 8)
+
+/* No swap slot. */
+#define SWAP_NONE ((size_t) -1)
+
+/* An evicted page. */
+struct swap_entry {
+	unsigned ref_cnt;           /* Pages that refer to it. */
+	size_t slot;                /* Slot on disk, or SWAP_NONE. */
+	void *data;                 /* Compressed contents, or null. */
+	size_t size;                /* Bytes in DATA. */
+	struct list_elem elem;      /* In ZCACHE_LRU while DATA is nonnull. */
+};
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +76,292 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+static struct lock swap_lock;       /* Protects everything below. */
+static struct bitmap *swap_map;     /* Used slots. */
+static struct slab_cache entry_cache; /* Struct swap_entry. */
+
+/* Compressed cache, most recently stored first. */
+static struct list zcache_lru;
+static size_t zcache_bytes;         /* Bytes of compressed data. */
+static uint16_t lz_work[LZ_HASH_SIZE]; /* lz_compress() scratch. */
+static uint8_t zbuf[PGSIZE];        /* Compression and write-back buffer. */
+
+/* Statistics. */
+static size_t slots_used;           /* Slots in use. */
+static uint64_t pages_in;           /* Pages read from disk. */
+static uint64_t pages_out;          /* Pages written to disk. */
+static uint64_t cycles_in;          /* Cycles spent reading them. */
+static uint64_t cycles_out;         /* Cycles spent writing them. */
+static uint64_t zcache_stores;      /* Pages stored compressed. */
+static uint64_t zcache_hits;        /* Pages swapped in from memory. */
+static uint64_t zcache_rejects;     /* Pages that did not compress. */
+static uint64_t zcache_writebacks;  /* Entries moved on to disk. */
+
+static size_t zcache_shrink_count (void *);
+static size_t zcache_shrink_scan (size_t page_cnt, void *);
+
+/* Writes compressed pages to disk under memory pressure. */
+static struct shrinker zcache_shrinker = {
+	.name = "zcache",
+	.priority = SHRINK_PRI_DATA,
+	.count = zcache_shrink_count,
+	.scan = zcache_shrink_scan,
+};
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt = 0;
+
+	swap_disk = disk_get (1, 1);
+	if (swap_disk != NULL)
+		slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+
+	lock_init (&swap_lock);
+	swap_map = bitmap_create (slot_cnt);
+	if (swap_map == NULL)
+		PANIC ("cannot allocate swap table");
+	slab_cache_init (&entry_cache, "swap entry", sizeof (struct swap_entry),
+			__alignof__ (struct swap_entry), NULL);
+	list_init (&zcache_lru);
+	shrinker_register (&zcache_shrinker);
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
-	struct anon_page *anon_page = &page->anon;
+	page->anon.swap = NULL;
+	memset (kva, 0, PGSIZE);
+	return true;
+}
+
+/* Writes the page at KVA to a new slot on disk and returns the
+ * slot, or SWAP_NONE if the disk is full.  SWAP_LOCK must be
+ * held. */
+static size_t
+slot_write (const void *kva) {
+	uint64_t start;
+	size_t slot, i;
+
+	slot = bitmap_scan_and_flip_next (swap_map, 1, false);
+	if (slot == BITMAP_ERROR)
+		return SWAP_NONE;
+	slots_used++;
+
+	start = rdtsc ();
+	for (i = 0; i < SLOT_SECTORS; i++)
+		disk_write (swap_disk, slot * SLOT_SECTORS + i,
+				(const uint8_t *) kva + i * DISK_SECTOR_SIZE);
+	pages_out++;
+	cycles_out += rdtsc () - start;
+	return slot;
+}
+
+/* Moves ENTRY's contents from the compressed cache to disk.
+ * Returns false if the disk is full.  SWAP_LOCK must be held. */
+static bool
+zcache_writeback (struct swap_entry *entry) {
+	size_t slot;
+
+	if (!lz_decompress (entry->data, entry->size, zbuf, PGSIZE))
+		PANIC ("compressed swap entry is corrupt");
+	slot = slot_write (zbuf);
+	if (slot == SWAP_NONE)
+		return false;
+
+	list_remove (&entry->elem);
+	zcache_bytes -= entry->size;
+	free (entry->data);
+	entry->data = NULL;
+	entry->slot = slot;
+	zcache_writebacks++;
+	return true;
+}
+
+/* Writes the oldest entries of the compressed cache to disk until
+ * it holds no more than MAX_BYTES, or the disk is full.  Returns
+ * the number of bytes freed.  SWAP_LOCK must be held. */
+static size_t
+zcache_trim (size_t max_bytes) {
+	size_t start = zcache_bytes;
+
+	while (zcache_bytes > max_bytes
+			&& zcache_writeback (list_entry (list_back (&zcache_lru),
+					struct swap_entry, elem)))
+		continue;
+	return start - zcache_bytes;
+}
+
+/* Drops a reference to ENTRY, freeing it when none are left.
+ * SWAP_LOCK must be held. */
+static void
+entry_put (struct swap_entry *entry) {
+	ASSERT (entry->ref_cnt > 0);
+	if (--entry->ref_cnt > 0)
+		return;
+
+	if (entry->data != NULL) {
+		list_remove (&entry->elem);
+		zcache_bytes -= entry->size;
+		free (entry->data);
+	} else {
+		bitmap_reset (swap_map, entry->slot);
+		slots_used--;
+	}
+	slab_free (&entry_cache, entry);
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
-	struct anon_page *anon_page = &page->anon;
+	struct swap_entry *entry = page->anon.swap;
+	bool success = true;
+	size_t slot;
+
+	ASSERT (entry != NULL);
+
+	lock_acquire (&swap_lock);
+	slot = entry->slot;
+	if (entry->data != NULL) {
+		success = lz_decompress (entry->data, entry->size, kva, PGSIZE);
+		zcache_hits++;
+	}
+	lock_release (&swap_lock);
+
+	/* Our reference keeps an entry on disk where it is. */
+	if (slot != SWAP_NONE) {
+		uint64_t start = rdtsc ();
+		size_t i;
+
+		for (i = 0; i < SLOT_SECTORS; i++)
+			disk_read (swap_disk, slot * SLOT_SECTORS + i,
+					(uint8_t *) kva + i * DISK_SECTOR_SIZE);
+
+		lock_acquire (&swap_lock);
+		pages_in++;
+		cycles_in += rdtsc () - start;
+		lock_release (&swap_lock);
+	}
+
+	lock_acquire (&swap_lock);
+	entry_put (entry);
+	page->anon.swap = NULL;
+	page->owner->spt.usage.swap--;
+	lock_release (&swap_lock);
+	return success;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	struct swap_entry *entry;
+	size_t size;
+
+	entry = slab_alloc (&entry_cache);
+	if (entry == NULL)
+		return false;
+	entry->ref_cnt = 1;
+	entry->slot = SWAP_NONE;
+	entry->data = NULL;
+
+	lock_acquire (&swap_lock);
+	size = lz_compress (page->frame->kva, PGSIZE, zbuf, ZCACHE_MAX_SIZE,
+			lz_work);
+	if (size > 0 && (entry->data = malloc (size)) != NULL) {
+		memcpy (entry->data, zbuf, size);
+		entry->size = size;
+		list_push_front (&zcache_lru, &entry->elem);
+		zcache_bytes += size;
+		zcache_stores++;
+		zcache_trim (ZCACHE_MAX);
+	} else {
+		if (size == 0)
+			zcache_rejects++;
+		entry->slot = slot_write (page->frame->kva);
+	}
+	if (entry->data != NULL || entry->slot != SWAP_NONE) {
+		page->anon.swap = entry;
+		page->owner->spt.usage.swap++;
+	}
+	lock_release (&swap_lock);
+
+	if (page->anon.swap == NULL) {
+		slab_free (&entry_cache, entry);
+		return false;
+	}
+	page->dirty = false;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	vm_release_frame (page, false);
+	if (page->anon.swap != NULL) {
+		lock_acquire (&swap_lock);
+		entry_put (page->anon.swap);
+		page->anon.swap = NULL;
+		page->owner->spt.usage.swap--;
+		lock_release (&swap_lock);
+	}
+}
+
+/* Turns CHILD, a new page without a frame, into an anonymous page
+ * with the contents of PARENT.  If PARENT is swapped out, CHILD
+ * shares its swap entry; otherwise the caller must give CHILD the
+ * contents.  A null PARENT stands for a page not yet written. */
+void
+anon_share (struct page *child, const struct page *parent) {
+	ASSERT (child->frame == NULL);
+
+	child->operations = &anon_ops;
+	child->anon.swap = parent != NULL ? parent->anon.swap : NULL;
+	if (child->anon.swap != NULL) {
+		lock_acquire (&swap_lock);
+		child->anon.swap->ref_cnt++;
+		child->owner->spt.usage.swap++;
+		lock_release (&swap_lock);
+	}
+}
+
+/* Shrinker: counts the pages of compressed data. */
+static size_t
+zcache_shrink_count (void *aux UNUSED) {
+	return zcache_bytes / PGSIZE;
+}
+
+/* Shrinker: writes about PAGE_CNT pages of compressed data to
+ * disk, unless SWAP_LOCK is busy. */
+static size_t
+zcache_shrink_scan (size_t page_cnt, void *aux UNUSED) {
+	size_t freed;
+
+	if (lock_held_by_current_thread (&swap_lock)
+			|| !lock_try_acquire (&swap_lock))
+		return 0;
+	freed = zcache_trim (zcache_bytes > page_cnt * PGSIZE
+			? zcache_bytes - page_cnt * PGSIZE : 0);
+	lock_release (&swap_lock);
+	return freed / PGSIZE;
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	lock_acquire (&swap_lock);
+	printf ("Swap: %zu of %zu slots in use, %'"PRIu64" pages in "
+			"(%'"PRIu64" cycles each), %'"PRIu64" pages out "
+			"(%'"PRIu64" cycles each)\n",
+			slots_used, bitmap_size (swap_map),
+			pages_in, pages_in ? cycles_in / pages_in : 0,
+			pages_out, pages_out ? cycles_out / pages_out : 0);
+	printf ("Compressed swap: %zu pages in %'zu bytes, %'"PRIu64" stored, "
+			"%'"PRIu64" swapped in, %'"PRIu64" incompressible, "
+			"%'"PRIu64" written back\n",
+			list_size (&zcache_lru), zcache_bytes, zcache_stores,
+			zcache_hits, zcache_rejects, zcache_writebacks);
+	lock_release (&swap_lock);
 }
@@ -1,6 +1,12 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "user/syscall.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,6 +20,34 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* A memory mapping: PAGE_CNT pages of file-backed memory starting
+ * at ADDR.  Each page holds its own handle on the file, so the
+ * mapping outlives the descriptor it was made from. */
+struct mmap_region {
+	void *addr;                 /* First page. */
+	size_t page_cnt;            /* Number of pages. */
+	struct list_elem elem;      /* Element in spt's mmaps list. */
+};
+
+/* Acquires filesys_lock, as the system calls do around file
+ * operations, unless the current thread holds it already because
+ * a system call faulted on a user buffer.  Returns true if it
+ * acquired the lock, to be passed to fs_unlock(). */
+static bool
+fs_lock (void) {
+	if (lock_held_by_current_thread (&filesys_lock))
+		return false;
+	lock_acquire (&filesys_lock);
+	return true;
+}
+
+/* Releases filesys_lock if ACQUIRED, as returned by fs_lock(). */
+static void
+fs_unlock (bool acquired) {
+	if (acquired)
+		lock_release (&filesys_lock);
+}
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
@@ -21,38 +55,242 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
+	page->file.text = (type & VM_TEXT) != 0;
+	return true;
+}
 
-	struct file_page *file_page = &page->file;
+/* Takes over the struct file_segment AUX as the backing of PAGE
+ * and loads PAGE from it, on the first fault. */
+bool
+file_lazy_load (struct page *page, void *aux) {
+	struct file_segment *seg = aux;
+
+	page->file.seg = *seg;
+	free (seg);
+	return file_backed_swap_in (page, page->frame->kva);
+}
+
+/* Makes PAGE, a file page, ready to map a frame that another page
+ * has already loaded with the same contents. */
+void
+file_backed_adopt (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		struct file_segment *seg = page->uninit.aux;
+
+		file_backed_initializer (page, page->uninit.type, NULL);
+		page->file.seg = *seg;
+		free (seg);
+	}
+	page->dirty = false;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_segment *seg = &page->file.seg;
+	bool acquired = fs_lock ();
+	off_t bytes = file_read_at (seg->file, kva, seg->read_bytes, seg->ofs);
+
+	fs_unlock (acquired);
+	if (bytes != (off_t) seg->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+	page->dirty = false;
+	return true;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  A clean
+ * page is simply dropped, since the file still has its contents.
+ * This runs under the frame table lock, which comes after
+ * filesys_lock, so unlike the other file operations here it does
+ * not take filesys_lock; see vm.c. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_segment *seg = &page->file.seg;
+
+	if (page->dirty) {
+		file_write_at (seg->file, page->frame->kva, seg->read_bytes, seg->ofs);
+		page->dirty = false;
+	}
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	bool acquired;
+
+	vm_release_frame (page, true);
+	acquired = fs_lock ();
+	file_close (page->file.seg.file);
+	fs_unlock (acquired);
+}
+
+/* Adds to the current process a page like PAGE, which belongs to
+ * its parent, backed by the same part of the same file. */
+bool
+file_backed_copy (struct page *page) {
+	struct file_segment *seg = file_segment_dup (&page->file.seg);
+
+	return seg != NULL
+		&& vm_alloc_page_with_initializer (
+				VM_FILE | (page->file.text ? VM_TEXT : 0),
+				page->va, page->writable, file_lazy_load, seg);
+}
+
+/* Removes the first PAGE_CNT pages of REGION from the current
+ * process, writing back the dirty ones. */
+static void
+unmap_pages (struct mmap_region *region, size_t page_cnt) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++) {
+		struct page *page = spt_find_page (spt,
+				(uint8_t *) region->addr + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	off_t file_len;
+	bool acquired;
+	size_t i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	if (!is_user_vaddr (addr) || length > (uintptr_t) KERN_BASE
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1))
+		return NULL;
+	acquired = fs_lock ();
+	file_len = file_length (file);
+	fs_unlock (acquired);
+	if (file_len == 0)
+		return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->addr = addr;
+	region->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	for (i = 0; i < region->page_cnt; i++)
+		if (spt_find_page (spt, (uint8_t *) addr + i * PGSIZE) != NULL) {
+			free (region);
+			return NULL;
+		}
+
+	for (i = 0; i < region->page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		struct file_segment *seg = malloc (sizeof *seg);
+
+		if (seg != NULL) {
+			acquired = fs_lock ();
+			seg->file = file_reopen (file);
+			fs_unlock (acquired);
+			seg->ofs = ofs;
+			seg->read_bytes = ofs < file_len
+				? (file_len - ofs < PGSIZE ? file_len - ofs : PGSIZE) : 0;
+			if (seg->file == NULL) {
+				free (seg);
+				seg = NULL;
+			}
+		}
+		if (seg == NULL
+				|| !vm_alloc_page_with_initializer (VM_FILE,
+					(uint8_t *) addr + i * PGSIZE, writable,
+					file_lazy_load, seg)) {
+			unmap_pages (region, i);
+			free (region);
+			return NULL;
+		}
+	}
+	list_push_back (&spt->mmaps, &region->elem);
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->mmaps); e != list_end (&spt->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		if (region->addr == addr) {
+			unmap_pages (region, region->page_cnt);
+			list_remove (&region->elem);
+			free (region);
+			return;
+		}
+	}
+}
+
+/* Copies the list of mappings of SRC, the parent's table, into
+ * DST, whose pages have already been copied. */
+bool
+mmap_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (&src->mmaps); e != list_end (&src->mmaps);
+			e = list_next (e)) {
+		struct mmap_region *region = list_entry (e, struct mmap_region, elem);
+		struct mmap_region *copy = malloc (sizeof *copy);
+
+		if (copy == NULL)
+			return false;
+		*copy = *region;
+		list_push_back (&dst->mmaps, &copy->elem);
+	}
+	return true;
+}
+
+/* Frees SPT's list of mappings, whose pages are already gone. */
+void
+mmap_kill (struct supplemental_page_table *spt) {
+	while (!list_empty (&spt->mmaps))
+		free (list_entry (list_pop_front (&spt->mmaps),
+					struct mmap_region, elem));
+}
+
+/* Returns a copy of SEG with its own file handle, or a null
+ * pointer if memory is not available. */
+struct file_segment *
+file_segment_dup (const struct file_segment *seg) {
+	struct file_segment *copy = malloc (sizeof *copy);
+	bool acquired;
+
+	if (copy == NULL)
+		return NULL;
+	*copy = *seg;
+	acquired = fs_lock ();
+	copy->file = file_reopen (seg->file);
+	fs_unlock (acquired);
+	if (copy->file == NULL) {
+		free (copy);
+		return NULL;
+	}
+	return copy;
+}
+
+/* Closes SEG's file and frees SEG. */
+void
+file_segment_free (struct file_segment *seg) {
+	bool acquired = fs_lock ();
+
+	file_close (seg->file);
+	fs_unlock (acquired);
+	free (seg);
 }
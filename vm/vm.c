@@ -1,9 +1,211 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <hash.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Cache of struct page. */
+static struct slab_cache page_cache;
+
+/* Cache of supplemental page table nodes. */
+static struct slab_cache spt_node_cache;
+
+/* The supplemental page table is a radix tree with the shape of
+ * the x86-64 page table: four levels of 512-way nodes, each
+ * indexed by the same 9 bits of the virtual address as the
+ * hardware table at that depth.  Finding a page takes four array
+ * lookups and no hashing.  Nodes are allocated the first time a
+ * page is inserted below them and freed when they empty again.
+ * Each node counts its nonnull slots, so walks over the whole
+ * table stop scanning a node once they have seen them all and
+ * never descend into empty subtrees. */
+#define SPT_BITS 9
+#define SPT_FANOUT (1 << SPT_BITS)
+#define SPT_LEVELS 4
+
+/* A node of the tree.  Slots at level 0 point to struct pages,
+ * slots at higher levels to child nodes. */
+struct spt_node {
+	size_t cnt;            /* Number of nonnull slots. */
+	void **slots;          /* SPT_FANOUT slots, in a page of their own. */
+};
+
+/* The frame table has one struct frame for every physical page
+ * of RAM, indexed by physical page number, so the entry for any
+ * user page is found without searching, even when the user pool
+ * has borrowed the page from the kernel pool.  Frames that hold
+ * a user page are also kept on a circular list, swept by a clock
+ * hand that gives recently accessed pages a second chance.
+ *
+ * FRAME_LOCK protects the clock list and the link between every
+ * page and its frame.  Eviction holds it across swap_out(), so a
+ * process that faults on a page being evicted waits until the
+ * page is fully written out.  swap_out() must therefore never
+ * wait for filesys_lock, which is taken before FRAME_LOCK when a
+ * system call faults on a user buffer.  Everything else in the VM
+ * that uses a file, including swap_in(), which runs without
+ * FRAME_LOCK, takes filesys_lock like the system calls do, unless
+ * the faulting system call holds it already.
+ *
+ * Before swap_out() is called on a page, the page has been
+ * unmapped and its dirty member updated from the page table.
+ * swap_out() saves the contents to the backing store if needed.
+ *
+ * Fork shares the parent's anonymous frames with the child
+ * instead of copying them.  A frame keeps a list of the pages
+ * that map it, and is mapped read-only into all of them while
+ * there is more than one.  The first write through any of them
+ * faults, and vm_handle_wp() gives the writer a copy of its own;
+ * the last page left takes the frame over without copying.
+ * Evicting a shared frame writes it out once, and its pages
+ * share the swap slot.
+ *
+ * ZERO_FRAME is a page of zeros shared the same way by every
+ * anonymous page that has been read but never written, such as
+ * untouched BSS.  It holds a reference of its own, so it always
+ * counts as shared: it is mapped read-only, never freed, and a
+ * write always moves the page to a new frame.  It is not on the
+ * clock list, since evicting it would save nothing.
+ *
+ * The text cache shares the frames of read-only executable pages
+ * (VM_TEXT) among every process running the same program.  It
+ * maps each loaded text frame's (inode, offset, length) to the
+ * frame, and a text page that faults maps the cached frame if
+ * there is one instead of reading the file.  A frame is entered
+ * only once it is fully loaded, and leaves the cache when it is
+ * evicted or its last page goes away, so the cache never returns
+ * contents older than the running executables, which cannot be
+ * written.  Text pages are clean file pages, so evicting them
+ * just drops the frame.
+ *
+ * With -merge, a low-priority thread also merges anonymous frames
+ * whose contents are identical, in the manner of Linux's KSM.  It
+ * walks the clock list a batch at a time, checksumming each frame;
+ * a frame whose checksum is unchanged since the last visit is
+ * stable, and goes into a table keyed by checksum.  A stable frame
+ * that matches another byte for byte hands its pages over to it,
+ * and is freed.  The pages are write-protected before comparing,
+ * so that neither frame can change until the merge is done, and a
+ * later write separates the page again like any copy-on-write
+ * page.  All-zero frames merge into ZERO_FRAME.
+ *
+ * Each process counts its resident pages (RSS), which of those
+ * are backed by files, and, in anon.c, its pages in swap.  A page
+ * sharing a frame counts in every process that maps it, but pages
+ * on ZERO_FRAME do not count at all.  Another low-priority thread
+ * samples the accessed bits of all frames every WS_SAMPLE_MS
+ * milliseconds, moving each into the page's REFERENCED flag, from
+ * which the clock hand takes it instead.  The pages a process was
+ * seen using over the last few samples estimate its working set.
+ * On its first sweep the clock hand spares frames of processes
+ * whose RSS is within their working set, since those would fault
+ * the pages straight back in, and takes them from processes
+ * holding pages they do not use.  A process at its RSS limit
+ * (-rss-limit) gets new frames by evicting its own, or, when it
+ * has none it can give up, like any other process, so the limit
+ * is soft.  With
+ * -rss-report, each process's usage is printed as it exits. */
+static struct frame *frame_table;
+static struct list clock_list;
+static struct list_elem *clock_hand;
+static size_t clock_cnt;
+static struct lock frame_lock;
+
+/* Statistics. */
+static uint64_t evict_cnt;      /* Pages evicted. */
+static uint64_t scan_cnt;       /* Frames the clock hand passed. */
+static uint64_t cow_share_cnt;  /* Pages shared with a child at fork. */
+static uint64_t cow_copy_cnt;   /* Shared pages copied on write. */
+static uint64_t cow_reuse_cnt;  /* Writes to pages no longer shared. */
+static struct frame *zero_frame;
+static uint64_t zero_fault_cnt; /* Faults served by ZERO_FRAME. */
+static uint64_t zero_copy_cnt;  /* Pages moved off it by a write. */
+
+/* Identifies the contents of a text page. */
+struct text_key {
+	struct inode *inode;   /* Executable. */
+	off_t ofs;             /* Offset of the page in it. */
+	size_t read_bytes;     /* Bytes read from there; the rest is zeros. */
+};
+
+/* A text cache entry. */
+struct text_entry {
+	struct text_key key;
+	struct frame *frame;   /* Frame holding the contents. */
+	struct hash_elem elem; /* Element in TEXT_CACHE. */
+};
+
+static struct hash text_cache;  /* Protected by FRAME_LOCK. */
+static uint64_t text_hit_cnt;   /* Text faults served from the cache. */
+
+/* A stable frame in the merge table. */
+struct merge_entry {
+	uint64_t checksum;     /* Contents of FRAME. */
+	struct frame *frame;
+	struct hash_elem elem; /* Element in MERGE_TABLE. */
+};
+
+size_t merge_scan_pages;        /* Frames per pass, 0 to disable. */
+unsigned merge_scan_ms = 100;   /* Sleep between passes. */
+static struct hash merge_table; /* Protected by FRAME_LOCK. */
+static struct list_elem *merge_cursor; /* Next frame to scan. */
+static uint64_t zero_checksum;  /* Checksum of ZERO_FRAME. */
+static uint64_t merge_scan_cnt; /* Frames checksummed. */
+static uint64_t merged_cnt;     /* Pages merged into other frames. */
+static uint64_t unmerged_cnt;   /* Pages separated again by a write. */
+
+static uint64_t fa_fault_cnt;   /* Fault-around counters of processes */
+static uint64_t fa_mapped_cnt;  /* that have exited or exec'd. */
+
+size_t rss_limit;               /* Default RSS limit, 0 for none. */
+unsigned ws_sample_ms = 100;    /* Sampling period, 0 to disable. */
+bool rss_report;                /* Print each process's usage at exit. */
+static unsigned ws_epoch;       /* Number of the sample in progress. */
+static uint64_t ws_sample_cnt;  /* Samples taken. */
+static uint64_t limit_evict_cnt; /* Pages evicted by their own process. */
+static size_t rss_peak;         /* Largest RSS of an exited process, */
+static char rss_peak_name[16];  /* and the process's name. */
+
+static void zero_frame_init (void);
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+static hash_hash_func merge_hash;
+static hash_less_func merge_less;
+static uint64_t page_checksum (const void *kva);
+static thread_func merge_scanner NO_RETURN;
+static thread_func ws_sampler NO_RETURN;
+
+/* Fault-around.  A fault on a page read from a file also reads in
+ * the pages of the same file that follow it, once the process has
+ * shown that it reads that file sequentially.  Each process tracks
+ * up to FA_STREAMS streams, one per file (a mapping or executable
+ * segment), so that reading one does not open the window of
+ * another.  A stream starts with a window of one page, that is,
+ * no reading ahead, and keeps it until FAULT_AROUND_RUN faults in
+ * a row have each come where the last window ended; from then on
+ * the window doubles with every such fault.  A fault anywhere
+ * else in the file starts the run over and halves the window.
+ * Pages a program touches one at a time are thus never mapped
+ * before it touches them.  Fault-around only takes free frames,
+ * so it never evicts anything to read ahead. */
+#define FAULT_AROUND_MIN 1
+#define FAULT_AROUND_MAX 16
+#define FAULT_AROUND_RUN 3
+
+/* How far below USER_STACK the stack may grow. */
+#define STACK_MAX (1 << 20)
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -16,6 +218,22 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
+	slab_cache_init (&page_cache, "page", sizeof (struct page),
+			__alignof__ (struct page), NULL);
+	frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+			DIV_ROUND_UP (ram_pages * sizeof *frame_table, PGSIZE));
+	list_init (&clock_list);
+	lock_init (&frame_lock);
+	zero_frame_init ();
+	hash_init (&text_cache, text_hash, text_less, NULL);
+	hash_init (&merge_table, merge_hash, merge_less, NULL);
+	zero_checksum = page_checksum (zero_frame->kva);
+	if (merge_scan_pages > 0)
+		thread_create ("merge", PRI_MIN, merge_scanner, NULL);
+	if (ws_sample_ms > 0)
+		thread_create ("wss", PRI_MIN, ws_sampler, NULL);
+	slab_cache_init (&spt_node_cache, "spt node", sizeof (struct spt_node),
+			__alignof__ (struct spt_node), NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,13 +251,15 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (size_t *budget, struct thread *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *claim_pinned (struct page *page, bool may_evict);
+static struct frame *vm_evict_frame (struct thread *owner);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.  AUX, if nonnull, must be a struct file_segment that
+ * the page takes over, even on failure. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
@@ -47,96 +267,1070 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = slab_alloc (&page_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->writable = writable;
+		page->dirty = false;
+		page->referenced = false;
+		page->ws_seen = ws_epoch - 1;
+		page->owner = thread_current ();
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			slab_free (&page_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
+	if (aux != NULL)
+		file_segment_free (aux);
 	return false;
 }
 
+/* Returns the index into a level-LEVEL node of VA. */
+static inline size_t
+spt_index (const void *va, int level) {
+	return ((uint64_t) va >> (PTXSHIFT + level * SPT_BITS)) & (SPT_FANOUT - 1);
+}
+
+/* Returns a new, empty node, or a null pointer if memory is not
+ * available. */
+static struct spt_node *
+spt_node_create (void) {
+	struct spt_node *n = slab_alloc (&spt_node_cache);
+
+	if (n == NULL)
+		return NULL;
+	n->slots = palloc_get_page (PAL_ZERO);
+	if (n->slots == NULL) {
+		slab_free (&spt_node_cache, n);
+		return NULL;
+	}
+	n->cnt = 0;
+	return n;
+}
+
+/* Frees node N. */
+static void
+spt_node_destroy (struct spt_node *n) {
+	palloc_free_page (n->slots);
+	slab_free (&spt_node_cache, n);
+}
+
+/* Frees the empty nodes on the path from the root of SPT to VA,
+ * from the bottom up. */
+static void
+spt_prune (struct supplemental_page_table *spt, const void *va) {
+	struct spt_node *path[SPT_LEVELS];
+	struct spt_node *n = spt->root;
+	int level = SPT_LEVELS - 1;
+
+	if (n == NULL)
+		return;
+	path[level] = n;
+	while (level > 0 && (n = n->slots[spt_index (va, level)]) != NULL)
+		path[--level] = n;
+
+	for (; level < SPT_LEVELS && path[level]->cnt == 0; level++) {
+		spt_node_destroy (path[level]);
+		if (level + 1 < SPT_LEVELS) {
+			path[level + 1]->slots[spt_index (va, level + 1)] = NULL;
+			path[level + 1]->cnt--;
+		} else
+			spt->root = NULL;
+	}
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct spt_node *n = spt->root;
+	int level;
 
-	return page;
+	if (!is_user_vaddr (va))
+		return NULL;
+	for (level = SPT_LEVELS - 1; n != NULL && level > 0; level--)
+		n = n->slots[spt_index (va, level)];
+	return n != NULL ? n->slots[spt_index (va, 0)] : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	void *va = page->va;
+	struct spt_node *n;
+	void **slot;
+	int level;
 
-	return succ;
+	if (!is_user_vaddr (va) || pg_ofs (va) != 0)
+		return false;
+
+	if (spt->root == NULL && (spt->root = spt_node_create ()) == NULL)
+		return false;
+	n = spt->root;
+	for (level = SPT_LEVELS - 1; level > 0; level--) {
+		slot = &n->slots[spt_index (va, level)];
+		if (*slot == NULL) {
+			*slot = spt_node_create ();
+			if (*slot == NULL) {
+				spt_prune (spt, va);
+				return false;
+			}
+			n->cnt++;
+		}
+		n = *slot;
+	}
+
+	slot = &n->slots[spt_index (va, 0)];
+	if (*slot != NULL)
+		return false;
+	*slot = page;
+	n->cnt++;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes PAGE from SPT and frees it. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	struct spt_node *n = spt->root;
+	int level;
+
+	for (level = SPT_LEVELS - 1; level > 0; level--)
+		n = n->slots[spt_index (page->va, level)];
+	ASSERT (n->slots[spt_index (page->va, 0)] == page);
+	n->slots[spt_index (page->va, 0)] = NULL;
+	n->cnt--;
+	spt->page_cnt--;
+	spt_prune (spt, page->va);
+
 	vm_dealloc_page (page);
+}
+
+/* Calls FUNC on every page below node N, which is at level
+ * LEVEL, in order of address.  Stops and returns false as soon
+ * as FUNC returns false. */
+static bool
+spt_walk (struct spt_node *n, int level,
+		bool (*func) (struct page *, void *aux), void *aux) {
+	size_t i, seen;
+
+	for (i = seen = 0; seen < n->cnt; i++) {
+		if (n->slots[i] == NULL)
+			continue;
+		seen++;
+		if (level == 0 ? !func (n->slots[i], aux)
+				: !spt_walk (n->slots[i], level - 1, func, aux))
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns the frame table entry for the page at kernel virtual
+ * address KVA. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+kva_to_frame (void *kva) {
+	uintptr_t pfn = vtop (kva) >> PGBITS;
 
-	return victim;
+	ASSERT (pfn < ram_pages);
+	return &frame_table[pfn];
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Sets up ZERO_FRAME. */
+static void
+zero_frame_init (void) {
+	void *kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
+	zero_frame = kva_to_frame (kva);
+	zero_frame->kva = kva;
+	list_init (&zero_frame->pages);
+	zero_frame->page_cnt = 1;
+	zero_frame->pinned = true;
+}
+
+/* Returns a hash of text cache entry E. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_key *k = &hash_entry (e, struct text_entry, elem)->key;
+
+	return hash_bytes (&k->inode, sizeof k->inode)
+		^ hash_int (k->ofs) ^ hash_int (k->read_bytes);
+}
+
+/* Orders text cache entries A and B by key. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_key *a = &hash_entry (a_, struct text_entry, elem)->key;
+	const struct text_key *b = &hash_entry (b_, struct text_entry, elem)->key;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Stores the text cache key of PAGE in *KEY and returns true, if
+ * PAGE is a text page not in memory.  Otherwise returns false. */
+static bool
+text_key (struct page *page, struct text_key *key) {
+	const struct file_segment *seg;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			if ((page->uninit.type & VM_TEXT) == 0)
+				return false;
+			seg = page->uninit.aux;
+			break;
+		case VM_FILE:
+			if (!page->file.text)
+				return false;
+			seg = &page->file.seg;
+			break;
+		default:
+			return false;
+	}
+	key->inode = file_get_inode (seg->file);
+	key->ofs = seg->ofs;
+	key->read_bytes = seg->read_bytes;
+	return true;
+}
+
+/* Returns the frame cached for KEY, or a null pointer.
+ * FRAME_LOCK must be held. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+text_lookup (const struct text_key *key) {
+	struct text_entry probe;
+	struct hash_elem *e;
+
+	probe.key = *key;
+	e = hash_find (&text_cache, &probe.elem);
+	return e != NULL ? hash_entry (e, struct text_entry, elem)->frame : NULL;
+}
+
+/* Enters FRAME, just loaded, in the text cache under KEY, unless
+ * another frame got there first or memory is short. */
+static void
+text_insert (const struct text_key *key, struct frame *frame) {
+	struct text_entry *entry = malloc (sizeof *entry);
+
+	if (entry == NULL)
+		return;
+	entry->key = *key;
+	entry->frame = frame;
+	lock_acquire (&frame_lock);
+	if (hash_insert (&text_cache, &entry->elem) == NULL)
+		frame->text = entry;
+	else
+		free (entry);
+	lock_release (&frame_lock);
+}
 
+/* Takes FRAME out of the merge table.  FRAME_LOCK must be held. */
+static void
+merge_remove (struct frame *frame) {
+	if (frame->merge != NULL) {
+		hash_delete (&merge_table, &frame->merge->elem);
+		free (frame->merge);
+		frame->merge = NULL;
+	}
+}
+
+/* Takes FRAME, which is about to be freed or reused, out of the
+ * text cache and the merge table.  FRAME_LOCK must be held. */
+static void
+frame_forget (struct frame *frame) {
+	if (frame->text != NULL) {
+		hash_delete (&text_cache, &frame->text->elem);
+		free (frame->text);
+		frame->text = NULL;
+	}
+	merge_remove (frame);
+}
+
+/* Puts FRAME on the clock list, just behind the hand, so that it
+ * is the last frame the hand reaches. */
+static void
+clock_insert (struct frame *frame) {
+	if (clock_hand == NULL) {
+		list_push_back (&clock_list, &frame->elem);
+		clock_hand = &frame->elem;
+	} else
+		list_insert (clock_hand, &frame->elem);
+	clock_cnt++;
+}
+
+/* Moves the clock hand to the next frame, wrapping around. */
+static void
+clock_advance (void) {
+	clock_hand = list_next (clock_hand);
+	if (clock_hand == list_end (&clock_list))
+		clock_hand = list_begin (&clock_list);
+}
+
+/* Takes FRAME off the clock list. */
+static void
+clock_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem) {
+		clock_advance ();
+		if (clock_hand == &frame->elem)
+			clock_hand = NULL;
+	}
+	if (merge_cursor == &frame->elem)
+		merge_cursor = list_next (merge_cursor);
+	list_remove (&frame->elem);
+	clock_cnt--;
+}
+
+/* Unmaps PAGE, which has a frame, from its owner's page table and
+ * records in PAGE whether it was written. */
+static void
+unmap_page (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4_is_dirty (pml4, page->va))
+		page->dirty = true;
+	pml4_clear_page (pml4, page->va);
+}
+
+/* Maps PAGE to FRAME in its owner's page table, writable only if
+ * PAGE is and no other page shares FRAME. */
+static bool
+map_page (struct page *page, struct frame *frame) {
+	return pml4_set_page (page->owner->pml4, page->va, frame->kva,
+			page->writable && frame->page_cnt == 1);
+}
+
+/* Adds DELTA to the RSS of PAGE's owner, which PAGE is about to
+ * join or has just left. */
+static void
+usage_add (struct page *page, int delta) {
+	struct vm_usage *u = &page->owner->spt.usage;
+
+	u->rss += delta;
+	if (page_get_type (page) == VM_FILE)
+		u->file += delta;
+	if (u->rss > u->rss_peak)
+		u->rss_peak = u->rss;
+}
+
+/* Returns true if OWNER may not have another frame. */
+static bool
+over_limit (struct thread *owner) {
+	struct vm_usage *u = &owner->spt.usage;
+
+	return u->rss_limit != 0 && u->rss >= u->rss_limit;
+}
+
+/* Links PAGE to FRAME. */
+static void
+frame_add_page (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->page_cnt++;
+	page->frame = frame;
+	page->referenced = false;
+	if (frame != zero_frame)
+		usage_add (page, 1);
+}
+
+/* Unpins FRAME, which claim_pinned() returned.  ZERO_FRAME stays
+ * pinned for good. */
+static void
+frame_unpin (struct frame *frame) {
+	frame->pinned = frame == zero_frame;
+}
+
+/* Unlinks PAGE from its frame. */
+static void
+frame_remove_page (struct page *page) {
+	list_remove (&page->frame_elem);
+	page->frame->page_cnt--;
+	if (page->frame != zero_frame)
+		usage_add (page, -1);
+	page->frame = NULL;
+}
+
+/* Brings U's working set estimate up to date with the current
+ * sample.  Each finished sample averages into the estimate, and
+ * samples that saw nothing halve it. */
+static void
+ws_update (struct vm_usage *u) {
+	unsigned lag = ws_epoch - u->ws_epoch;
+
+	if (lag == 0)
+		return;
+	u->ws = (u->ws + u->ws_cur) / 2;
+	u->ws = lag - 1 < 8 * sizeof u->ws ? u->ws >> (lag - 1) : 0;
+	u->ws_cur = 0;
+	u->ws_epoch = ws_epoch;
+}
+
+/* Returns the working set estimate of OWNER, in pages. */
+static size_t
+ws_estimate (struct thread *owner) {
+	struct vm_usage *u = &owner->spt.usage;
+
+	ws_update (u);
+	return u->ws > u->ws_cur ? u->ws : u->ws_cur;
+}
+
+/* Moves PAGE's accessed bit into its REFERENCED flag, counting the
+ * page in its owner's working set the first time in a sample that
+ * it is seen accessed.  Returns the flag. */
+static bool
+page_referenced (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4_is_accessed (pml4, page->va)) {
+		pml4_set_accessed (pml4, page->va, false);
+		page->referenced = true;
+		if (page->ws_seen != ws_epoch) {
+			page->ws_seen = ws_epoch;
+			ws_update (&page->owner->spt.usage);
+			page->owner->spt.usage.ws_cur++;
+		}
+	}
+	return page->referenced;
+}
+
+/* Returns true if the clock hand should spare FRAME, which has
+ * not been referenced, on its first sweep: its owner is using
+ * about as many pages as it holds, give or take a quarter. */
+static bool
+frame_in_working_set (struct frame *frame) {
+	struct thread *owner = list_entry (list_front (&frame->pages),
+			struct page, frame_elem)->owner;
+
+	return ws_sample_ms > 0 && !over_limit (owner)
+		&& owner->spt.usage.rss <= ws_estimate (owner) * 5 / 4;
+}
+
+/* Returns true if FRAME holds only a page of OWNER. */
+static bool
+frame_owned_by (struct frame *frame, struct thread *owner) {
+	return frame->page_cnt == 1
+		&& list_entry (list_front (&frame->pages),
+				struct page, frame_elem)->owner == owner;
+}
+
+/* Get the struct frame, that will be evicted.  Sweeps the clock
+ * hand over at most *BUDGET frames, charging each one to it.
+ * Returns a null pointer if the budget runs out first.  If OWNER
+ * is nonnull, only frames that hold nothing but a page of OWNER
+ * are considered, and no others are spared. */
+static struct frame *
+vm_get_victim (size_t *budget, struct thread *owner) {
+	while (*budget > 0 && clock_hand != NULL) {
+		struct frame *frame = list_entry (clock_hand, struct frame, elem);
+		bool accessed = false;
+		struct list_elem *e;
+
+		clock_advance ();
+		scan_cnt++;
+		(*budget)--;
+		if (frame->pinned
+				|| (owner != NULL && !frame_owned_by (frame, owner)))
+			continue;
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+
+			if (page_referenced (page)) {
+				/* Second chance. */
+				page->referenced = false;
+				accessed = true;
+			}
+		}
+		if (accessed)
+			continue;
+		if (owner == NULL && *budget >= clock_cnt
+				&& frame_in_working_set (frame))
+			continue;
+		return frame;
+	}
 	return NULL;
 }
 
+/* Pages written out by one eviction.  Evicting a cluster at a
+ * time spreads the cost of a clock sweep over several frames, and
+ * since swap slots are handed out next-fit, the anonymous pages of
+ * a cluster reach the swap disk as one sequential run. */
+#define EVICT_CLUSTER 8
+
+/* Evict one page and return the corresponding frame.
+ * Return NULL on error.  Up to EVICT_CLUSTER - 1 further victims
+ * found within the same budget are evicted too, and their frames
+ * returned to the user pool for the allocations that follow.  Two
+ * full sweeps of the clock bound the work: the first clears every
+ * accessed bit, so the second finds a victim unless every frame
+ * is pinned or cannot be saved.  If OWNER is nonnull, evicts only
+ * frames of OWNER's; see vm_get_victim(). */
+static struct frame *
+vm_evict_frame (struct thread *owner) {
+	size_t budget = 2 * clock_cnt;
+	struct frame *first = NULL;
+	struct frame *frame;
+	size_t cnt = 0;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while (cnt < EVICT_CLUSTER
+			&& (frame = vm_get_victim (&budget, owner)) != NULL) {
+		struct page *page = list_entry (list_front (&frame->pages),
+				struct page, frame_elem);
+		struct list_elem *e;
+
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e))
+			unmap_page (list_entry (e, struct page, frame_elem));
+		if (!swap_out (page)) {
+			/* Could not save it.  Map it back and keep looking.  A
+			 * fault on it meanwhile waits for FRAME_LOCK, and then
+			 * finds it resident in claim_pinned(). */
+			for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+					e = list_next (e))
+				map_page (list_entry (e, struct page, frame_elem), frame);
+			continue;
+		}
+
+		/* Anonymous pages that shared the frame share the swap slot
+		 * PAGE was just written to.  Text pages read theirs back
+		 * from the file. */
+		while (!list_empty (&frame->pages)) {
+			struct page *p = list_entry (list_back (&frame->pages),
+					struct page, frame_elem);
+
+			frame_remove_page (p);
+			if (p != page && VM_TYPE (p->operations->type) == VM_ANON)
+				anon_share (p, page);
+		}
+		frame_forget (frame);
+		clock_remove (frame);
+		evict_cnt++;
+		if (owner != NULL)
+			limit_evict_cnt++;
+		if (first == NULL)
+			first = frame;
+		else
+			palloc_free_page (frame->kva);
+		cnt++;
+	}
+	return first;
+}
+
+/* Returns a free frame from the user pool, or a null pointer if
+ * there is none.  FRAME_LOCK must be held. */
+static struct frame *
+get_free_frame (void) {
+	struct frame *frame;
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		return NULL;
+	frame = kva_to_frame (kva);
+	frame->kva = kva;
+	list_init (&frame->pages);
+	frame->page_cnt = 0;
+	frame->text = NULL;
+	frame->checksum = 0;
+	frame->merge = NULL;
+	frame->merged = false;
+	return frame;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  Returns a null pointer only if nothing can be
+ * evicted.  The frame is for a page of OWNER, which, if it is at
+ * its RSS limit, evicts a page of its own for it.  The limit is a
+ * soft one: if none of OWNER's frames can be evicted, because
+ * they are pinned or swap is full, OWNER gets a frame like any
+ * other process rather than failing a fault that only it could
+ * make room for.  FRAME_LOCK must be held. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (struct thread *owner) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	if (over_limit (owner))
+		frame = vm_evict_frame (owner);
+	if (frame == NULL)
+		frame = get_free_frame ();
+	if (frame == NULL)
+		frame = vm_evict_frame (NULL);
+
+	ASSERT (frame == NULL || frame->page_cnt == 0);
 	return frame;
 }
 
+/* Frees PAGE's frame, if it has one, after unmapping it.  If
+ * WRITEBACK, first saves the contents with swap_out().  A frame
+ * that other pages share is left to them. */
+void
+vm_release_frame (struct page *page, bool writeback) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		unmap_page (page);
+		if (frame->page_cnt > 1)
+			frame_remove_page (page);
+		else {
+			ASSERT (!frame->pinned);
+			if (writeback)
+				swap_out (page);
+			clock_remove (frame);
+			frame_remove_page (page);
+			frame_forget (frame);
+			palloc_free_page (frame->kva);
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Prints frame table statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frames: %zu in use, %'"PRIu64" evictions, "
+			"%'"PRIu64" frames scanned\n", clock_cnt, evict_cnt, scan_cnt);
+	printf ("Copy-on-write: %'"PRIu64" pages shared, %'"PRIu64" copied, "
+			"%'"PRIu64" reused\n", cow_share_cnt, cow_copy_cnt, cow_reuse_cnt);
+	printf ("Text cache: %zu frames, %'"PRIu64" hits\n",
+			hash_size (&text_cache), text_hit_cnt);
+	printf ("Merging: %'"PRIu64" frames scanned, %zu stable, "
+			"%'"PRIu64" pages merged, %'"PRIu64" unmerged\n",
+			merge_scan_cnt, hash_size (&merge_table), merged_cnt, unmerged_cnt);
+	printf ("Fault-around: %'"PRIu64" file faults, %'"PRIu64" pages "
+			"mapped around them\n", fa_fault_cnt, fa_mapped_cnt);
+	printf ("Zero page: %'"PRIu64" faults, %zu frames saved now, "
+			"%'"PRIu64" pages written\n",
+			zero_fault_cnt, zero_frame->page_cnt - 1, zero_copy_cnt);
+	printf ("Resident sets: %'"PRIu64" working-set samples, "
+			"%'"PRIu64" pages evicted at RSS limit, peak %zu pages (%s)\n",
+			ws_sample_cnt, limit_evict_cnt, rss_peak,
+			rss_peak > 0 ? rss_peak_name : "none");
+	anon_print_stats ();
+}
+
+/* Same-page merging. */
+
+/* Returns a hash of merge table entry E. */
+static uint64_t
+merge_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct merge_entry, elem)->checksum;
+}
+
+/* Orders merge table entries A and B by checksum. */
+static bool
+merge_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct merge_entry, elem)->checksum
+		< hash_entry (b, struct merge_entry, elem)->checksum;
+}
+
+/* Returns a checksum of the page at KVA: FNV-1a, a word at a
+ * time. */
+static uint64_t
+page_checksum (const void *kva) {
+	const uint64_t *p = kva;
+	uint64_t sum = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *p; i++)
+		sum = (sum ^ p[i]) * 0x100000001b3ULL;
+	return sum;
+}
+
+/* Write-protects every page of FRAME, leaving it mapped. */
+static void
+protect_frame (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		pml4_set_writable (page->owner->pml4, page->va, false);
+	}
+}
+
+/* Undoes protect_frame (FRAME), making writable again the pages
+ * that map_page() would map writable. */
+static void
+unprotect_frame (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->writable && frame->page_cnt == 1)
+			pml4_set_writable (page->owner->pml4, page->va, true);
+	}
+}
+
+/* If FRAME has the same contents as TARGET, moves FRAME's pages
+ * over to TARGET and frees FRAME.  Pages on ZERO_FRAME are always
+ * read-only, so it needs no protecting. */
+static void
+merge_frames (struct frame *frame, struct frame *target) {
+	if (target->pinned && target != zero_frame)
+		return;
+	protect_frame (frame);
+	if (target != zero_frame)
+		protect_frame (target);
+	if (memcmp (frame->kva, target->kva, PGSIZE) != 0) {
+		unprotect_frame (frame);
+		if (target != zero_frame)
+			unprotect_frame (target);
+		return;
+	}
+
+	/* TARGET's own pages stay read-only, now that it is shared.
+	 * A fault on a moved page in between its unmapping and its
+	 * mapping waits for FRAME_LOCK and finds it resident. */
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_front (&frame->pages),
+				struct page, frame_elem);
+
+		unmap_page (page);
+		frame_remove_page (page);
+		frame_add_page (target, page);
+		map_page (page, target);
+		merged_cnt++;
+	}
+	if (target != zero_frame)
+		target->merged = true;
+
+	clock_remove (frame);
+	frame_forget (frame);
+	palloc_free_page (frame->kva);
+}
+
+/* Checksums FRAME and merges it with a stable frame with the same
+ * contents, if it is stable itself and there is one. */
+static void
+merge_scan_frame (struct frame *frame) {
+	struct page *page = list_entry (list_front (&frame->pages),
+			struct page, frame_elem);
+	struct merge_entry probe;
+	struct merge_entry *entry;
+	struct hash_elem *e;
+	uint64_t sum;
+
+	if (frame->pinned || VM_TYPE (page->operations->type) != VM_ANON)
+		return;
+
+	merge_scan_cnt++;
+	sum = page_checksum (frame->kva);
+	if (sum != frame->checksum) {
+		/* Changed since the last visit. */
+		frame->checksum = sum;
+		merge_remove (frame);
+		return;
+	}
+	if (frame->merge != NULL)
+		return;
+
+	if (sum == zero_checksum) {
+		merge_frames (frame, zero_frame);
+		return;
+	}
+	probe.checksum = sum;
+	e = hash_find (&merge_table, &probe.elem);
+	if (e != NULL) {
+		merge_frames (frame, hash_entry (e, struct merge_entry, elem)->frame);
+		return;
+	}
+
+	entry = malloc (sizeof *entry);
+	if (entry != NULL) {
+		entry->checksum = sum;
+		entry->frame = frame;
+		frame->merge = entry;
+		hash_insert (&merge_table, &entry->elem);
+	}
+}
+
+/* Scans up to MERGE_SCAN_PAGES frames every MERGE_SCAN_MS
+ * milliseconds, carrying on where the last batch ended. */
+static void
+merge_scanner (void *aux UNUSED) {
+	for (;;) {
+		size_t cnt;
+
+		lock_acquire (&frame_lock);
+		for (cnt = 0; cnt < merge_scan_pages && clock_cnt > 0; cnt++) {
+			struct frame *frame;
+
+			if (merge_cursor == NULL || merge_cursor == list_end (&clock_list))
+				merge_cursor = list_begin (&clock_list);
+			frame = list_entry (merge_cursor, struct frame, elem);
+			merge_cursor = list_next (merge_cursor);
+			merge_scan_frame (frame);
+		}
+		lock_release (&frame_lock);
+		timer_msleep (merge_scan_ms);
+	}
+}
+
+/* Working-set sampling. */
+
+/* Every WS_SAMPLE_MS milliseconds, moves the accessed bits of all
+ * pages in frames into their REFERENCED flags, counting them in
+ * their owners' working sets, and starts a new sample. */
+static void
+ws_sampler (void *aux UNUSED) {
+	for (;;) {
+		struct list_elem *e, *p;
+
+		lock_acquire (&frame_lock);
+		for (e = list_begin (&clock_list); e != list_end (&clock_list);
+				e = list_next (e)) {
+			struct frame *frame = list_entry (e, struct frame, elem);
+
+			for (p = list_begin (&frame->pages); p != list_end (&frame->pages);
+					p = list_next (p))
+				page_referenced (list_entry (p, struct page, frame_elem));
+		}
+		ws_epoch++;
+		ws_sample_cnt++;
+		lock_release (&frame_lock);
+		timer_msleep (ws_sample_ms);
+	}
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON | VM_STACK, pg_round_down (addr), true);
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer
+ * at RSP, is the stack growing.  PUSH faults 8 bytes below RSP. */
+static bool
+is_stack_access (const void *addr, const void *rsp) {
+	return (uint8_t *) addr >= (uint8_t *) USER_STACK - STACK_MAX
+		&& (uint8_t *) addr < (uint8_t *) USER_STACK
+		&& (uint8_t *) addr >= (uint8_t *) rsp - 8;
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page.  A writable page is
+ * only write-protected while it shares its frame, so give it a
+ * copy of its own, or the frame itself if the other pages have
+ * gone in the meantime. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *shared, *frame;
+	bool success = false;
+
+	if (!page->writable)
+		return false;
+
+	lock_acquire (&frame_lock);
+	shared = page->frame;
+	if (shared == NULL) {
+		/* Evicted since the fault.  The retry faults it back in. */
+		success = true;
+	} else if (shared->page_cnt == 1) {
+		success = map_page (page, shared);
+		cow_reuse_cnt++;
+	} else {
+		/* Keep eviction away from the page we are copying. */
+		shared->pinned = true;
+		frame = vm_get_frame (page->owner);
+		shared->pinned = shared == zero_frame;
+		if (frame != NULL) {
+			if (shared == zero_frame) {
+				memset (frame->kva, 0, PGSIZE);
+				zero_copy_cnt++;
+			} else {
+				memcpy (frame->kva, shared->kva, PGSIZE);
+				cow_copy_cnt++;
+				if (shared->merged)
+					unmerged_cnt++;
+			}
+			unmap_page (page);
+			frame_remove_page (page);
+			frame_add_page (frame, page);
+			clock_insert (frame);
+			success = map_page (page, frame);
+		}
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Returns true if PAGE is anonymous, with no contents but zeros,
+ * and has never been accessed. */
+static bool
+is_untouched_anon (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Maps PAGE, which is untouched, to ZERO_FRAME. */
+static bool
+map_zero_frame (struct page *page) {
+	bool success;
+
+	anon_share (page, NULL);
+	lock_acquire (&frame_lock);
+	frame_add_page (zero_frame, page);
+	success = map_page (page, zero_frame);
+	zero_fault_cnt++;
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Returns true if PAGE, not in memory, would be read from a file:
+ * a lazily loaded executable page, or a page of a mapped file. */
+static bool
+is_file_backed (struct page *page) {
+	enum vm_type type = VM_TYPE (page->operations->type);
+
+	if (type == VM_UNINIT)
+		return page->uninit.aux != NULL;
+	return type == VM_FILE;
+}
+
+/* Returns the inode that PAGE, not in memory, would be read
+ * from, or a null pointer if it is not file-backed. */
+static struct inode *
+page_inode (struct page *page) {
+	if (!is_file_backed (page))
+		return NULL;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return file_get_inode (((struct file_segment *) page->uninit.aux)->file);
+	return file_get_inode (page->file.seg.file);
+}
+
+/* Returns FA's stream for a fault at VA on a page of INODE: the
+ * stream that expected it, else the stream of INODE, which starts
+ * its run over, else a new stream. */
+static struct fa_stream *
+fa_stream_find (struct fault_around *fa, struct inode *inode, void *va) {
+	struct fa_stream *s, *same = NULL;
+
+	for (s = fa->streams; s < fa->streams + FA_STREAMS; s++)
+		if (s->inode == inode) {
+			if (s->next == va) {
+				s->run++;
+				return s;
+			}
+			same = s;
+		}
+
+	if (same != NULL) {
+		same->window = same->window / 2 > FAULT_AROUND_MIN
+			? same->window / 2 : FAULT_AROUND_MIN;
+		same->run = 1;
+		return same;
+	}
+
+	s = &fa->streams[fa->victim++ % FA_STREAMS];
+	s->inode = inode;
+	s->window = FAULT_AROUND_MIN;
+	s->run = 1;
+	return s;
+}
+
+/* Adjusts the fault-around window of SPT's stream for a fault on
+ * the page at VA of INODE, which has just been read in, and reads
+ * in the pages of INODE after it that the window covers. */
+static void
+fault_around (struct supplemental_page_table *spt, struct inode *inode,
+		void *va) {
+	struct fault_around *fa = &spt->fa;
+	struct fa_stream *s = fa_stream_find (fa, inode, va);
+	uint8_t *next = (uint8_t *) va + PGSIZE;
+	size_t i;
+
+	if (s->run >= FAULT_AROUND_RUN)
+		s->window = s->window * 2 < FAULT_AROUND_MAX
+			? s->window * 2 : FAULT_AROUND_MAX;
+	fa->faults++;
+
+	/* Only our own faults bring our pages in, so a page we see
+	 * without a frame stays that way until we claim it. */
+	for (i = 1; i < s->window; i++, next += PGSIZE) {
+		struct page *page = spt_find_page (spt, next);
+		struct frame *frame;
+
+		if (page == NULL
+				|| (page->frame == NULL && page_inode (page) != inode))
+			break;
+		if (page->frame == NULL) {
+			frame = claim_pinned (page, false);
+			if (frame == NULL)
+				break;
+			frame_unpin (frame);
+			fa->mapped++;
+		}
+	}
+	s->next = next;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *curr = thread_current ();
+	struct supplemental_page_table *spt = &curr->spt;
+	struct page *page;
 
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		/* A fault in the kernel happens during a system call, so
+		 * the user's stack pointer is the one saved on entry. */
+		void *rsp = user ? (void *) f->rsp : curr->user_rsp;
+		if (!not_present || !is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+	}
+
+	if (!not_present)
+		return write && vm_handle_wp (page);
+	if (write && !page->writable)
+		return false;
+	if (!write && is_untouched_anon (page))
+		return map_zero_frame (page);
+	if (is_file_backed (page)) {
+		struct inode *inode = page_inode (page);
+
+		if (!vm_do_claim_page (page))
+			return false;
+		fault_around (spt, inode, page->va);
+		return true;
+	}
 	return vm_do_claim_page (page);
 }
 
@@ -145,46 +1339,255 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 void
 vm_dealloc_page (struct page *page) {
 	destroy (page);
-	free (page);
+	slab_free (&page_cache, page);
 }
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
+/* Gives PAGE a frame, loads its contents with swap_in(), and
+ * maps it.  Evicts another page for the frame only if MAY_EVICT.
+ * If PAGE turns out to have a frame already, just maps it again.
+ * Returns the frame, still pinned, or a null pointer on failure. */
+static struct frame *
+claim_pinned (struct page *page, bool may_evict) {
+	struct text_key key;
+	bool text = text_key (page, &key);
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL) {
+		/* Still resident: unmapped only for a moment, by an eviction
+		 * that then failed or by a merge, while we waited for the
+		 * lock.  Map it again instead of loading a second copy. */
+		bool mapped;
+
+		frame = page->frame;
+		mapped = map_page (page, frame);
+		frame->pinned = true;
+		lock_release (&frame_lock);
+		if (!mapped) {
+			frame_unpin (frame);
+			return NULL;
+		}
+		return frame;
+	}
+	if (text && (frame = text_lookup (&key)) != NULL
+			&& (may_evict || !over_limit (page->owner))) {
+		/* Another process has loaded it already.  Map it while we
+		 * hold the lock, so that it cannot be evicted first.  Sharing
+		 * the frame still adds to our RSS, so at the limit we give up
+		 * a frame of our own for it, as in vm_get_frame(). */
+		bool mapped;
+
+		frame->pinned = true;
+		if (over_limit (page->owner)) {
+			struct frame *own = vm_evict_frame (page->owner);
+
+			if (own != NULL)
+				palloc_free_page (own->kva);
+		}
+		file_backed_adopt (page);
+		frame_add_page (frame, page);
+		mapped = map_page (page, frame);
+		text_hit_cnt++;
+		lock_release (&frame_lock);
+		if (!mapped) {
+			frame->pinned = false;
+			vm_release_frame (page, false);
+			return NULL;
+		}
+		return frame;
+	}
+	if (may_evict)
+		frame = vm_get_frame (page->owner);
+	else
+		frame = over_limit (page->owner) ? NULL : get_free_frame ();
+	if (frame != NULL) {
+		/* Set links */
+		frame_add_page (frame, page);
+		frame->pinned = true;
+		clock_insert (frame);
+	}
+	lock_release (&frame_lock);
+	if (frame == NULL)
+		return NULL;
+
+	if (!swap_in (page, frame->kva)
+			|| !map_page (page, frame)) {
+		frame->pinned = false;
+		vm_release_frame (page, false);
+		return NULL;
+	}
+	if (text)
+		text_insert (&key, frame);
+	return frame;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
-
-	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	struct frame *frame = claim_pinned (page, true);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-
-	return swap_in (page, frame->kva);
+	if (frame == NULL)
+		return false;
+	frame_unpin (frame);
+	return true;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	list_init (&spt->mmaps);
+	memset (&spt->fa, 0, sizeof spt->fa);
+	memset (&spt->usage, 0, sizeof spt->usage);
+	spt->usage.rss_limit = rss_limit;
+	spt->usage.ws_epoch = ws_epoch;
+}
+
+/* Gives the current process an anonymous page at the address of
+ * PAGE, the parent's, that shares PAGE's frame copy-on-write, or
+ * its swap slot if it is swapped out. */
+static bool
+share_anon_page (struct page *page) {
+	struct page *child;
+	struct frame *frame;
+	bool success = true;
+
+	if (!vm_alloc_page (VM_ANON, page->va, page->writable))
+		return false;
+	child = spt_find_page (&thread_current ()->spt, page->va);
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	anon_share (child, page);
+	if (frame != NULL) {
+		frame_add_page (frame, child);
+		unmap_page (page);
+		success = map_page (page, frame) && map_page (child, frame);
+		cow_share_cnt++;
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Copies PAGE, from the parent, into the current process's
+ * supplemental page table. */
+static bool
+copy_page (struct page *page, void *aux UNUSED) {
+	enum vm_type type = VM_TYPE (page->operations->type);
+	struct frame *parent, *frame;
+	struct page *child;
+
+	if (type == VM_UNINIT) {
+		/* Still lazy: share the recipe, not the contents. */
+		struct file_segment *seg = page->uninit.aux;
+
+		if (seg != NULL && (seg = file_segment_dup (seg)) == NULL)
+			return false;
+		return vm_alloc_page_with_initializer (page->uninit.type, page->va,
+				page->writable, page->uninit.init, seg);
+	}
+
+	if (type == VM_ANON)
+		return share_anon_page (page);
+
+	if (!file_backed_copy (page))
+		return false;
+	if (page->file.text)
+		return true;        /* The child maps the cached frame. */
+
+	/* Copy what the parent has in memory, pinning it meanwhile. */
+	lock_acquire (&frame_lock);
+	parent = page->frame;
+	if (parent != NULL)
+		parent->pinned = true;
+	lock_release (&frame_lock);
+	if (parent == NULL)
+		return true;
+
+	child = spt_find_page (&thread_current ()->spt, page->va);
+	frame = claim_pinned (child, true);
+	if (frame != NULL) {
+		memcpy (frame->kva, parent->kva, PGSIZE);
+		child->dirty = true;
+		frame_unpin (frame);
+	}
+	parent->pinned = false;
+	return frame != NULL;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	ASSERT (dst == &thread_current ()->spt);
+
+	return (src->root == NULL
+			|| spt_walk (src->root, SPT_LEVELS - 1, copy_page, NULL))
+		&& mmap_copy (dst, src);
+}
+
+/* Frees node N, at level LEVEL, and every page and node below
+ * it. */
+static void
+spt_destroy (struct spt_node *n, int level) {
+	size_t i, seen;
+
+	for (i = seen = 0; seen < n->cnt; i++) {
+		if (n->slots[i] == NULL)
+			continue;
+		seen++;
+		if (level == 0)
+			vm_dealloc_page (n->slots[i]);
+		else
+			spt_destroy (n->slots[i], level - 1);
+	}
+	spt_node_destroy (n);
+}
+
+/* Prints the memory use of the current process, whose SPT is
+ * SPT. */
+static void
+usage_report (struct supplemental_page_table *spt) {
+	struct vm_usage u;
+	size_t ws;
+
+	lock_acquire (&frame_lock);
+	ws = ws_estimate (thread_current ());
+	u = spt->usage;
+	lock_release (&frame_lock);
+
+	printf ("%s: rss %zu pages (%zu file-backed, peak %zu), "
+			"%zu swapped out, working set %zu pages\n",
+			thread_current ()->name, u.rss, u.file, u.rss_peak, u.swap, ws);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	if (rss_report && spt->root != NULL)
+		usage_report (spt);
+	if (spt->root != NULL)
+		spt_destroy (spt->root, SPT_LEVELS - 1);
+	mmap_kill (spt);
+
+	lock_acquire (&frame_lock);
+	fa_fault_cnt += spt->fa.faults;
+	fa_mapped_cnt += spt->fa.mapped;
+	if (spt->usage.rss_peak > rss_peak) {
+		rss_peak = spt->usage.rss_peak;
+		strlcpy (rss_peak_name, thread_current ()->name, sizeof rss_peak_name);
+	}
+	lock_release (&frame_lock);
+	supplemental_page_table_init (spt);
 }